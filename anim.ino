@@ -0,0 +1,231 @@
+/*
+ * Non-blocking LED animation.
+ *
+ * An animation is a sequence of keyframes. Each keyframe changes the
+ * color from the previous one to its own over 'ms' milliseconds, with
+ * an easing. anim_tick(), called from loop(), advances it on a millis()
+ * driven tick in 8.8 fixed point; nothing here ever blocks.
+ *
+ * The sequence is played 'loops' times (0 is forever), and keyframes
+ * pushed while a one-shot sequence is playing are queued after it.
+ */
+#include "brink.h"
+
+#define ANIM_KEYFRAMES_MAX  8
+#define ANIM_TICK_MS        10   /* 100 updates per second */
+
+typedef struct {
+    uint8_t  rgb[3];
+    uint8_t  ease;
+    uint16_t ms;
+} anim_keyframe_t;
+
+static struct {
+    anim_keyframe_t frames[ANIM_KEYFRAMES_MAX];
+    uint8_t  count;    /* number of keyframes; 0 if not running */
+    uint8_t  pos;      /* current keyframe */
+    uint8_t  loops;    /* remaining plays of the sequence; 0 is forever */
+    uint8_t  from[3];  /* the color the current keyframe started from */
+    uint8_t  cur[3];   /* the color on the LED */
+    uint8_t  pattern;  /* the pattern playing (1 origin), or 0 */
+    uint8_t  base[3];  /* the color when the pattern started */
+    unsigned long start_ms;  /* when the current keyframe started */
+    unsigned long tick_ms;   /* last tick */
+} anim;
+
+
+static void anim_apply(uint8_t r, uint8_t g, uint8_t b)
+{
+    anim.cur[0] = r;
+    anim.cur[1] = g;
+    anim.cur[2] = b;
+    led_rgb(r, g, b);
+}
+
+/*
+ * Stop the animation, and set the color right now.
+ */
+void anim_set(uint8_t r, uint8_t g, uint8_t b)
+{
+    anim.count   = 0;
+    anim.pattern = 0;
+    anim_apply(r, g, b);
+}
+
+/*
+ * Output the current color again, e.g. after led_set_brightness().
+ */
+void anim_refresh(void)
+{
+    led_rgb(anim.cur[0], anim.cur[1], anim.cur[2]);
+}
+
+/*
+ * Stop the animation, leaving the current color as it is.
+ */
+void anim_stop(void)
+{
+    anim.count   = 0;
+    anim.pattern = 0;
+}
+
+bool anim_running(void)
+{
+    return ( anim.count > 0 );
+}
+
+/* true if the running animation ends by itself */
+bool anim_oneshot(void)
+{
+    return ( anim.loops == 1 );
+}
+
+/*
+ * Append a keyframe. Starts the animation if it's not running.
+ * Returns false if no more keyframes can be queued.
+ */
+bool anim_push(uint8_t r, uint8_t g, uint8_t b, uint16_t ms, uint8_t ease)
+{
+    if ( anim.count >= ANIM_KEYFRAMES_MAX ) {
+        return false;
+    }
+    if ( anim.count == 0 ) {
+        anim.pattern = 0;
+        memcpy(anim.from, anim.cur, sizeof(anim.from));
+        anim.pos      = 0;
+        anim.loops    = 1;
+        anim.start_ms = millis();
+    }
+    anim_keyframe_t* kf = &anim.frames[anim.count++];
+    kf->rgb[0] = r;
+    kf->rgb[1] = g;
+    kf->rgb[2] = b;
+    kf->ms     = ms;
+    kf->ease   = ease;
+    return true;
+}
+
+/*
+ * Play the keyframes pushed so far 'loops' times, or forever if 0.
+ */
+void anim_loop(uint8_t loops)
+{
+    anim.loops = loops;
+}
+
+
+void anim_tick(void)
+{
+    unsigned long now = millis();
+
+    if ( anim.count == 0 || now - anim.tick_ms < ANIM_TICK_MS ) {
+        return;
+    }
+    anim.tick_ms = now;
+
+    const anim_keyframe_t* kf = &anim.frames[anim.pos];
+    unsigned long elapsed = now - anim.start_ms;
+    bool done = ( elapsed >= kf->ms );
+
+    /* progress of this keyframe; 0 to 256 */
+    uint16_t p = done ? 256 : (uint32_t)elapsed * 256 / kf->ms;
+    switch ( kf->ease ) {
+        case ANIM_EASE_STEP:
+            p = 256;
+            break;
+        case ANIM_EASE_INOUT:
+            p = (uint32_t)p * p * (3 * 256 - 2 * p) >> 16;
+            break;
+    }
+
+    uint8_t c[3];
+    for ( uint8_t i = 0;  i < 3;  i++ ) {
+        int32_t delta = (int16_t)kf->rgb[i] - anim.from[i];
+        c[i] = anim.from[i] + delta * p / 256;
+    }
+    if ( memcmp(c, anim.cur, sizeof(c)) != 0 ) {
+        anim_apply(c[0], c[1], c[2]);
+    }
+
+    if ( ! done ) {
+        return;
+    }
+
+    /* Go on to the next keyframe */
+    memcpy(anim.from, kf->rgb, sizeof(anim.from));
+    anim.start_ms += kf->ms; /* don't let the delay of this tick add up */
+    if ( ++anim.pos < anim.count ) {
+        return;
+    }
+    anim.pos = 0;
+    if ( anim.loops == 1 ) {
+        anim.count   = 0; /* finished */
+        anim.pattern = 0;
+    } else if ( anim.loops > 1 ) {
+        anim.loops--;
+    }
+}
+
+
+/*
+ * Start a predefined effect by its number (1 origin), in the order of the
+ * names in the schema of 'pattern' (shell.ino), after "stop" there.
+ * Returns false if no such pattern.
+ */
+bool anim_pattern_start(uint8_t id)
+{
+    uint8_t r = anim.cur[0];
+    uint8_t g = anim.cur[1];
+    uint8_t b = anim.cur[2];
+
+    anim_stop();
+    switch ( id ) {
+        case 1: /* breathe: in and out of the current color */
+            anim_push(0, 0, 0, 1500, ANIM_EASE_INOUT);
+            anim_push(r, g, b, 1500, ANIM_EASE_INOUT);
+            anim_loop(0);
+            break;
+
+        case 2: /* rainbow */
+            anim_push(255,   0,   0, 1000, ANIM_EASE_LINEAR);
+            anim_push(  0, 255,   0, 1000, ANIM_EASE_LINEAR);
+            anim_push(  0,   0, 255, 1000, ANIM_EASE_LINEAR);
+            anim_loop(0);
+            break;
+
+        case 3: /* alert */
+            anim_push(255,   0,   0, 150, ANIM_EASE_STEP);
+            anim_push(  0,   0,   0, 150, ANIM_EASE_STEP);
+            anim_loop(5);
+            break;
+
+        default:
+            return false;
+    }
+    anim.pattern = id;
+    anim.base[0] = r;
+    anim.base[1] = g;
+    anim.base[2] = b;
+    return true;
+}
+
+/*
+ * The state to be restored later by anim_set() and anim_pattern_start():
+ * the pattern playing (or 0), and the color it started from; otherwise
+ * the color the LED settles at. An animation which ends by itself, such
+ * as 'alert' or a counted blink, is not a state: the color it ends at is
+ * given instead, with no pattern, not to replay it at every boot.
+ */
+uint8_t anim_get_state(uint8_t rgb[3])
+{
+    if ( anim.count > 0 && anim.loops != 0 ) {
+        memcpy(rgb, anim.frames[anim.count - 1].rgb, 3);
+        return 0;
+    }
+    if ( anim.pattern ) {
+        memcpy(rgb, anim.base, 3);
+    } else {
+        memcpy(rgb, anim.cur, 3);
+    }
+    return anim.pattern;
+}
@@ -0,0 +1,154 @@
+/*
+ * Changing the baud rate at run time, with a fallback.
+ *
+ * A switch takes two phases, so that a rate the host (or a USB-serial
+ * bridge, or the clock of the device) can't handle never cuts the line:
+ *
+ *   1. 'baud <rate>' is answered at the current rate, and the device
+ *      switches to the new one once the reply and the prompt are out.
+ *   2. The host switches too, and confirms with 'baud ok' at the new
+ *      rate within BAUD_CONFIRM_MS. Otherwise the device goes back to
+ *      the old rate by itself.
+ *
+ * With 'save', the rate is written to EEPROM once it's confirmed, and
+ * used from the next boot.
+ */
+#include <stddef.h>
+#include <EEPROM.h>
+#include "brink.h"
+
+#define BAUD_CONFIRM_MS   2000
+#define BAUD_CHECK_SEED   0x5A
+
+typedef struct {
+    uint32_t rate;
+    uint8_t  check;  /* BAUD_CHECK_SEED + the bytes above, 8-bit */
+} baud_record_t;
+
+/* rates the line is known to run at, with the 16MHz clock of the Uno */
+static const uint32_t baud_rates[] PROGMEM = {
+    9600, 19200, 38400, 57600, 115200, 230400, 250000, 500000, 1000000,
+};
+
+enum baud_state {
+    BAUD_IDLE,
+    BAUD_PROPOSED,  /* to switch once the reply is out */
+    BAUD_SWITCHED,  /* waiting for 'baud ok' */
+};
+
+static struct {
+    uint8_t  state;
+    bool     save;
+    uint32_t rate;      /* current */
+    uint32_t fallback;  /* to go back to, unless confirmed */
+    unsigned long switched_ms;
+} baud;
+
+
+static uint8_t baud_checksum(const baud_record_t* rec)
+{
+    const uint8_t* p = (const uint8_t*)rec;
+    uint8_t sum = BAUD_CHECK_SEED;
+    for ( uint8_t i = 0;  i < offsetof(baud_record_t, check);  i++ ) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+bool baud_supported(uint32_t rate)
+{
+    for ( uint8_t i = 0;  i < sizeof(baud_rates) / sizeof(baud_rates[0]);  i++ ) {
+        if ( pgm_read_dword(&baud_rates[i]) == rate ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*
+ * Open Serial at the rate saved in EEPROM, or at 'rate' if none.
+ */
+void baud_setup(uint32_t rate)
+{
+    baud_record_t rec;
+
+    EEPROM.get(EEPROM_BAUD_ADDR, rec);
+    if ( rec.check == baud_checksum(&rec) && baud_supported(rec.rate) ) {
+        rate = rec.rate;
+    }
+    baud.rate = rate;
+    Serial.begin(rate);
+}
+
+uint32_t baud_get(void)
+{
+    return baud.rate;
+}
+
+
+/*
+ * Phase 1: switch to 'rate' after the reply of the current command.
+ */
+bool baud_propose(uint32_t rate, bool save)
+{
+    if ( baud.state != BAUD_IDLE || ! baud_supported(rate) ) {
+        return false;
+    }
+    baud.fallback = baud.rate;
+    baud.rate     = rate;
+    baud.save     = save;
+    baud.state    = BAUD_PROPOSED;
+    return true;
+}
+
+/*
+ * Phase 2: the host is talking at the new rate. Returns false if there's
+ * no switch to confirm.
+ */
+bool baud_confirm(void)
+{
+    if ( baud.state != BAUD_SWITCHED ) {
+        return false;
+    }
+    baud.state = BAUD_IDLE;
+    if ( baud.save ) {
+        baud_record_t rec;
+        rec.rate  = baud.rate;
+        rec.check = baud_checksum(&rec);
+        EEPROM.put(EEPROM_BAUD_ADDR, rec);
+    }
+    return true;
+}
+
+
+static void baud_switch(uint32_t rate)
+{
+    pico_flush();
+    Serial.flush(); /* until the last bit is out */
+    Serial.begin(rate);
+}
+
+/*
+ * Called from loop().
+ */
+void baud_tick(void)
+{
+    if ( baud.state == BAUD_PROPOSED && msh_line_active() ) {
+        baud_switch(baud.rate);
+        baud.switched_ms = millis();
+        baud.state = BAUD_SWITCHED;
+    }
+    else
+    if ( baud.state == BAUD_SWITCHED
+         && millis() - baud.switched_ms >= BAUD_CONFIRM_MS ) {
+        baud.rate  = baud.fallback;
+        baud.state = BAUD_IDLE;
+        baud_switch(baud.rate);
+        msh_puts_P(PSTR("\nbaud: not confirmed, back to "));
+        char buf[12];
+        pico_puts(ultoa(baud.rate, buf, 10));
+        pico_putchar('\n');
+        pico_flush();
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef __BRINK_H_INCLUDED__
+#define __BRINK_H_INCLUDED__
+
+/*
+ * Declarations shared among the sketch (*.ino) files.
+ */
+#include <stdint.h>
+
+/* brink.ino */
+void pico_set_mute(bool mute);
+void pico_rx_pause(void);
+
+/* led.ino */
+void led_setup(void);
+void led_off(void);
+void led_rgb(uint8_t r, uint8_t g, uint8_t b);
+void led_set_brightness(uint8_t level);
+uint8_t led_get_brightness(void);
+
+/* frame.ino */
+bool frame_feed(int c);
+
+/* anim.ino */
+#define ANIM_EASE_STEP      0    /* jump to the color, and hold it */
+#define ANIM_EASE_LINEAR    1
+#define ANIM_EASE_INOUT     2    /* smoothstep; slow at both ends */
+
+void anim_set(uint8_t r, uint8_t g, uint8_t b);
+void anim_stop(void);
+void anim_refresh(void);
+bool anim_running(void);
+bool anim_oneshot(void);
+bool anim_push(uint8_t r, uint8_t g, uint8_t b, uint16_t ms, uint8_t ease);
+void anim_loop(uint8_t loops);
+void anim_tick(void);
+bool anim_pattern_start(uint8_t id);
+uint8_t anim_get_state(uint8_t rgb[3]);
+
+/* persist.ino */
+typedef struct {
+    uint8_t seq;
+    uint8_t rgb[3];
+    uint8_t pattern;
+    uint8_t brightness;
+    uint8_t flags;
+    uint8_t check;   /* PERSIST_CHECK_SEED + the bytes above, 8-bit */
+} persist_record_t;
+
+bool persist_restore(void);
+void persist_save(void);
+void persist_set_autosave(bool enable);
+bool persist_get_autosave(void);
+void persist_tick(void);
+
+/* baud.ino */
+void baud_setup(uint32_t rate);
+uint32_t baud_get(void);
+bool baud_supported(uint32_t rate);
+bool baud_propose(uint32_t rate, bool save);
+bool baud_confirm(void);
+void baud_tick(void);
+
+/* macro.ino */
+#define MACRO_OK           0
+#define MACRO_ERR_SYNTAX   1  /* not "{ ... }", or can't be parsed */
+#define MACRO_ERR_COMMAND  2  /* no such command, or 'def' or 'baud' */
+#define MACRO_ERR_FULL     3
+#define MACRO_ERR_NAME     4  /* the name of a command */
+#define MACRO_ERR_ARGS     5  /* bad arguments to a typed command; printed */
+
+int macro_define(const char* name, const char* body, bool append);
+bool macro_delete(const char* name);
+int macro_run(const char* name);
+const char* macro_get(uint8_t i, const uint8_t** code, uint8_t* len);
+uint8_t macro_pool_used(void);
+void macro_save(void);
+bool macro_restore(void);
+
+/* mem.ino */
+typedef struct {
+    uint16_t ram;         /* SRAM in total */
+    uint16_t static_ram;  /* .data and .bss */
+    uint16_t heap_used;   /* malloc()ed, up to __brkval */
+    uint16_t stack_now;
+    uint16_t stack_max;   /* the deepest since boot */
+    uint16_t never_used;  /* between the heap and the deepest stack */
+} mem_info_t;
+
+bool mem_get(mem_info_t* info);
+
+/* stream.ino */
+typedef struct {
+    unsigned long received;
+    unsigned long applied;
+    unsigned long dropped;  /* replaced by a newer one before the tick */
+    unsigned long resync;   /* partial frames dropped */
+} stream_info_t;
+
+void stream_start(uint8_t fps);
+bool stream_feed(int c);
+void stream_tick(void);
+void stream_get_info(stream_info_t* info);
+
+/* strip.ino */
+#ifndef STRIP_PIXELS
+#define STRIP_PIXELS  60   /* the length of the LED strip, up to 255 */
+#endif
+
+typedef struct {
+    void (*begin)(void);                          /* may be NULL */
+    void (*show)(const uint8_t* grb, uint8_t n);  /* n pixels, 3 bytes each */
+} strip_driver_t;
+
+void strip_set_driver(const strip_driver_t* driver);
+void strip_setup(void);
+void strip_set(uint8_t i, const uint8_t rgb[3]);
+unsigned long strip_show(void);
+bool strip_parse_color(const char* s, uint8_t rgb[3]);
+bool strip_select(const char* sel, const uint8_t* rgb);
+
+/* sched.ino */
+typedef struct {
+    uint8_t  pending;
+    uint8_t  capacity;
+    uint16_t pool_used;     /* bytes of arguments */
+    uint16_t pool_size;
+    unsigned long run;
+    unsigned long failed;   /* returned non-zero */
+    unsigned long dropped;  /* no room to add */
+    unsigned long late_max_ms;
+} sched_info_t;
+
+bool sched_add(unsigned long due, int index, int argc, const char** argv);
+void sched_set_zero(unsigned long ms);
+unsigned long sched_at(unsigned long ms);
+void sched_clear(void);
+void sched_tick(void);
+void sched_get_info(sched_info_t* info);
+const void* sched_list(const void* prev, long* in_ms, const char** args, uint8_t* argc);
+
+/* EEPROM layout */
+#define EEPROM_PERSIST_ADDR   0    /* persist.ino: 64 records of 8 bytes */
+#define EEPROM_BAUD_ADDR      512  /* baud.ino: a record of 5 bytes */
+#define EEPROM_MACRO_ADDR     520  /* macro.ino: 4 bytes and the pool */
+
+#endif/*__BRINK_H_INCLUDED__*/
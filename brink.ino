@@ -1,54 +1,288 @@
 #include "picoshell.h"
+#include "brink.h"
 
-#define BAUD 9600
+#define BAUD 9600  /* unless another rate is saved by 'baud <rate> save' */
 
-int shell(void);
+void shell_setup(void);
+void shell_poll(void);
  
 void io_open(void) {};
 void io_close(void) {};
 
+/*
+ * XON/XOFF flow control of the input.
+ *
+ * The 64-byte RX buffer of Serial overflows silently when the host sends
+ * faster than the shell reads, e.g. while the shell waits for Serial to
+ * send out the echo back. So XOFF is sent when the RX buffer fills up to
+ * PICO_RX_HIGH, and XON once it's read down to PICO_RX_LOW.
+ *
+ * XOFF has to go out before the host sends (RX buffer size - PICO_RX_HIGH)
+ * more bytes, and it waits behind what's queued for transmission already.
+ * So serial_write() keeps no more than PICO_TX_DEPTH bytes queued in
+ * Serial, checking the RX buffer while it waits.
+ *
+ * Define PICO_XONXOFF to 0 to turn it off, e.g. for a host without IXON.
+ */
+#ifndef PICO_XONXOFF
+#define PICO_XONXOFF 1
+#endif
+
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE 64
+#endif
+
+#define PICO_XON      0x11
+#define PICO_XOFF     0x13
+#define PICO_RX_HIGH  (SERIAL_RX_BUFFER_SIZE / 2)
+#define PICO_RX_LOW   (SERIAL_RX_BUFFER_SIZE / 8)
+#define PICO_TX_DEPTH 8
+
+#if PICO_XONXOFF
+static bool rx_stopped; /* XOFF sent */
+#endif
+
+static void flow_check(void)
+{
+    int level = Serial.available();
+
+#ifdef MSH_CONFIG_STATS
+    static bool rx_full;
+    if ( level >= SERIAL_RX_BUFFER_SIZE - 1 ) {
+        if ( ! rx_full ) {
+            MSH_STAT_INC(rx_full);
+        }
+        rx_full = true;
+    } else {
+        rx_full = false;
+    }
+#endif
+#if PICO_XONXOFF
+    if ( ! rx_stopped && level >= PICO_RX_HIGH ) {
+        Serial.write(PICO_XOFF);
+        rx_stopped = true;
+        MSH_STAT_INC(xoff);
+    }
+    else
+    if ( rx_stopped && level <= PICO_RX_LOW ) {
+        Serial.write(PICO_XON);
+        rx_stopped = false;
+    }
+#endif
+}
+
+/*
+ * Stop the input for a while with interrupts off, longer than the USART
+ * can hold bytes received by itself (2, and a third being shifted in):
+ * sends XOFF, and waits until it's out and the host has stopped, that is,
+ * no byte for 2 byte times, up to PICO_PAUSE_MS. The next flow_check()
+ * sends XON. Without PICO_XONXOFF this does nothing, and input coming
+ * while interrupts are off is lost.
+ */
+#define PICO_PAUSE_MS  20  /* USB serial adapters may wait 16ms to send */
+
+void pico_rx_pause(void)
+{
+#if PICO_XONXOFF
+    unsigned long quiet_us = 20000000UL / baud_get();  /* 2 bytes of 10 bits */
+    unsigned long start    = millis();
+    unsigned long last;
+    int level;
+
+    if ( ! rx_stopped ) {
+        Serial.write(PICO_XOFF);
+        rx_stopped = true;
+        MSH_STAT_INC(xoff);
+    }
+    Serial.flush();
+    level = Serial.available();
+    last  = micros();
+    while ( micros() - last < quiet_us && millis() - start < PICO_PAUSE_MS ) {
+        if ( Serial.available() != level ) {
+            level = Serial.available();
+            last  = micros();
+        }
+    }
+#endif
+}
+
+int pico_trygetchar(void)
+{
+    flow_check();
+    while ( Serial.available() ) {
+        int c = Serial.read();
+        MSH_STAT_INC(bytes_in);
+        if ( stream_feed(c) ) {
+            continue; /* raw frames while streaming */
+        }
+        if ( frame_feed(c) ) {
+            continue; /* binary frames never reach the shell */
+        }
+        if ( c == '\r' ) {
+            return '\n';
+        } else {
+            return c;
+        }
+    }
+    return -1;
+}
+
 int pico_getchar(void)
 {
-    while( ! Serial.available() ) {
+    int c;
+    pico_flush();
+    while ( (c = pico_trygetchar()) < 0 ) {
         delay(1);
     }
-    int c = Serial.read();
-    if ( c == '\r' ) {
-        return '\n';
-    } else {
-        return c;
+    return c;
+}
+
+/*
+ * Output is staged in outbuf[] and handed to Serial in one write per
+ * pico_flush(), which the shell calls once per input event or command.
+ * Define PICO_OUTBUF_SIZE to 0 to write each byte directly, e.g. to
+ * compare the two with 'stats'. The rate on the wire is the same either
+ * way; what changes is the number of writes, and the time blocked in
+ * them, which 'stats' shows.
+ */
+#ifndef PICO_OUTBUF_SIZE
+#define PICO_OUTBUF_SIZE 32
+#endif
+
+static void serial_write(const uint8_t* buf, int len)
+{
+    MSH_STAT_TIMER(t0);
+
+    MSH_STAT_ADD(bytes_out, len);
+    while ( len > 0 ) {
+        flow_check();
+#if PICO_XONXOFF
+        int queued = SERIAL_TX_BUFFER_SIZE - 1 - Serial.availableForWrite();
+        int n = PICO_TX_DEPTH - queued;
+        if ( n <= 0 ) {
+            continue;
+        }
+        if ( n > len ) {
+            n = len;
+        }
+#else
+        int n = len;
+#endif
+        Serial.write(buf, n);
+        MSH_STAT_INC(writes);
+        buf += n;
+        len -= n;
     }
+    MSH_STAT_ELAPSED(write_us, t0);
 }
 
-int pico_putchar(int c)
+#if PICO_OUTBUF_SIZE > 0
+static uint8_t outbuf[PICO_OUTBUF_SIZE];
+static uint8_t outlen;
+
+void pico_flush(void)
 {
-    if ( c == '\n' ) {
-        Serial.write('\r');
+    if ( outlen > 0 ) {
+        serial_write(outbuf, outlen);
+        outlen = 0;
     }
-    Serial.write(c);
+}
+
+static inline void outbuf_put(uint8_t c)
+{
+    if ( outlen >= PICO_OUTBUF_SIZE ) {
+        pico_flush();
+    }
+    outbuf[outlen++] = c;
+}
+#else
+void pico_flush(void) {}
+
+static inline void outbuf_put(uint8_t c)
+{
+    serial_write(&c, 1);
+}
+#endif
+
+static bool out_muted;
+
+/*
+ * Discard all output while 'mute', e.g. of commands run in background.
+ */
+void pico_set_mute(bool mute)
+{
+    out_muted = mute;
+}
+
+int pico_write(const char* buf, int len)
+{
+    int i;
+    if ( out_muted ) {
+        return len;
+    }
+    for ( i = 0;  i < len;  i++ ) {
+        if ( buf[i] == '\n' ) {
+            outbuf_put('\r');
+        }
+        outbuf_put(buf[i]);
+    }
+    return len;
+}
+
+int pico_putchar(int c)
+{
+    char ch = c;
+    pico_write(&ch, 1);
     return 0;
 }
 
 int pico_puts(const char* s)
 {
-    const char* c = s;
-    while ( *c != '\0' ) {
-        pico_putchar(*c);
-        c++;
-    }
+    pico_write(s, strlen(s));
     return 1;
 }
 
+unsigned long pico_millis(void)
+{
+    return millis();
+}
+
+unsigned long pico_micros(void)
+{
+    return micros();
+}
+
+unsigned long boot_us; /* from reset to the shell ready */
+
 void setup()  {
+    char buf[12];
+
     led_setup();
-    Serial.begin(BAUD);
-    delay(10);
-    pico_puts("\n\n*** picoshell for Arduino ***\n");
+    strip_setup();
+    if ( ! persist_restore() ) {
+        /* Nothing saved: white for a second, then green */
+        anim_push(255, 255, 255, 1000, ANIM_EASE_STEP);
+        anim_push(  0, 255,   0,    0, ANIM_EASE_STEP);
+    }
+    baud_setup(BAUD);
+    shell_setup();
+    macro_restore();
+    boot_us = micros();
+
+    msh_puts_P(PSTR("\n\n*** picoshell for Arduino ***\n"));
+    msh_puts_P(PSTR("ready in "));
+    pico_puts(ultoa(boot_us, buf, 10));
+    msh_puts_P(PSTR(" us\n"));
 }
 
 void loop() {
-    led_rgb(255, 255, 255);
-    delay(1000);
-    led_rgb(  0, 255,   0);
-    shell();
+    shell_poll();
+    anim_tick();
+    persist_tick();
+    baud_tick();
+    sched_tick();
+    stream_tick();
 }
@@ -0,0 +1,163 @@
+/*
+ * Binary fast-path frames, interleaved with the text shell.
+ *
+ * A frame is recognized in the input path (pico_getchar()) before the
+ * line editor sees a byte, so it is never echoed nor tokenized:
+ *
+ *     FRAME_MAGIC  opcode  len  payload[len]  checksum
+ *
+ * 'checksum' is chosen so that the 8-bit sum of opcode, len, payload and
+ * checksum is zero. The device answers every complete frame with a
+ * single FRAME_ACK or FRAME_NAK byte.
+ *
+ * FRAME_MAGIC is not a printable nor a keybind character, but it is a
+ * UTF-8 continuation byte (e.g. in U+00A5, C2 A5, or U+00E5, C3 A5). So
+ * it starts a frame only right after an ASCII byte, or another frame;
+ * in UTF-8 it always follows a byte of 0x80 or more, and reaches the
+ * shell as it is.
+ */
+#include <stdint.h>
+
+#define FRAME_MAGIC        0xA5
+#define FRAME_ACK          0x06
+#define FRAME_NAK          0x15
+#define FRAME_PAYLOAD_MAX  8
+#define FRAME_TIMEOUT_MS   100   /* max gap between bytes of a frame */
+
+/* opcodes */
+#define FRAME_OP_PING      0x00  /* no payload */
+#define FRAME_OP_RGB       0x01  /* r g b */
+#define FRAME_OP_OFF       0x02  /* no payload */
+#define FRAME_OP_FADE      0x03  /* r g b ms(big endian, 2 bytes) */
+
+
+enum frame_state {
+    FRAME_IDLE,
+    FRAME_OPCODE,
+    FRAME_LEN,
+    FRAME_PAYLOAD,
+    FRAME_CHECKSUM,
+    FRAME_DISCARD,   /* the rest of a frame too long to take */
+};
+
+static struct {
+    uint8_t state;
+    uint8_t opcode;
+    uint8_t len;
+    uint8_t count;
+    uint8_t sum;
+    uint8_t payload[FRAME_PAYLOAD_MAX];
+    uint8_t prev;      /* the last byte passed on; 0 after a frame */
+    unsigned long last_ms;
+} frame;
+
+
+/*
+ * Execute a verified frame. Returns true if the opcode and payload
+ * length are valid.
+ */
+static bool frame_dispatch(uint8_t opcode, const uint8_t* payload, uint8_t len)
+{
+    switch ( opcode ) {
+        case FRAME_OP_PING:
+            return ( len == 0 );
+
+        case FRAME_OP_RGB:
+            if ( len != 3 ) {
+                return false;
+            }
+            anim_set(payload[0], payload[1], payload[2]);
+            return true;
+
+        case FRAME_OP_OFF:
+            if ( len != 0 ) {
+                return false;
+            }
+            anim_set(0, 0, 0);
+            return true;
+
+        case FRAME_OP_FADE:
+            if ( len != 5 ) {
+                return false;
+            }
+            anim_stop();
+            return anim_push(payload[0], payload[1], payload[2],
+                             (uint16_t)payload[3] << 8 | payload[4],
+                             ANIM_EASE_INOUT);
+
+        default:
+            return false;
+    }
+}
+
+
+/*
+ * Feed a received byte to the frame decoder.
+ * Returns true if the byte was consumed as a part of a frame, false if it
+ * should be passed on to the text shell.
+ */
+bool frame_feed(int c)
+{
+    unsigned long now = millis();
+
+    /* A stalled partial frame is discarded, and the byte starts over. */
+    if ( frame.state != FRAME_IDLE && now - frame.last_ms > FRAME_TIMEOUT_MS ) {
+        frame.state = FRAME_IDLE;
+    }
+    frame.last_ms = now;
+
+    switch ( frame.state ) {
+        case FRAME_IDLE:
+            if ( c != FRAME_MAGIC || frame.prev >= 0x80 ) {
+                frame.prev = c;
+                return false;
+            }
+            frame.prev  = 0;
+            frame.state = FRAME_OPCODE;
+            break;
+
+        case FRAME_OPCODE:
+            frame.opcode = c;
+            frame.sum    = c;
+            frame.state  = FRAME_LEN;
+            break;
+
+        case FRAME_LEN:
+            frame.len   = c;
+            frame.count = 0;
+            if ( c > FRAME_PAYLOAD_MAX ) {
+                /* swallowed, not to reach the shell as keystrokes */
+                frame.state = FRAME_DISCARD;
+                break;
+            }
+            frame.sum  += c;
+            frame.state = ( c == 0 ) ? FRAME_CHECKSUM : FRAME_PAYLOAD;
+            break;
+
+        case FRAME_PAYLOAD:
+            frame.payload[frame.count++] = c;
+            frame.sum += c;
+            if ( frame.count >= frame.len ) {
+                frame.state = FRAME_CHECKSUM;
+            }
+            break;
+
+        case FRAME_CHECKSUM:
+            frame.state = FRAME_IDLE;
+            if ( (uint8_t)(frame.sum + c) == 0
+                 && frame_dispatch(frame.opcode, frame.payload, frame.len) ) {
+                pico_putchar(FRAME_ACK);
+            } else {
+                pico_putchar(FRAME_NAK);
+            }
+            break;
+
+        case FRAME_DISCARD:
+            if ( frame.count++ == frame.len ) { /* the checksum */
+                frame.state = FRAME_IDLE;
+                pico_putchar(FRAME_NAK);
+            }
+            break;
+    }
+    return true;
+}
@@ -10,20 +10,27 @@
 #define MSH_CMD_HISTORY_MAX (32)
 #endif
 
+/* bytes for the history; as much as MSH_CMD_HISTORY_MAX full lines */
+#ifndef MSH_CMD_HISTORY_BYTES
+#define MSH_CMD_HISTORY_BYTES (MSH_CMD_HISTORY_MAX * MSH_CMDLINE_CHAR_MAX)
+#endif
+
 
 
 /*
- *  Add a 'line' to the command line history ring-buffer.
- *  If MSH_CMD_HISTORY_MAX exceeds, it overwrites the most old history
- *  If 'line' it too long (> MSH_CMD_HISTORY_MAX-1), just ignore.
+ *  Add a 'line' to the command line history.
+ *  Lines are packed by their length, and the oldest ones are dropped
+ *  when MSH_CMD_HISTORY_BYTES exceeds. So the number of lines it can hold
+ *  depends on their length.
+ *  If 'line' it too long (> MSH_CMDLINE_CHAR_MAX-1), empty, or the same
+ *  as the latest history, just ignore.
  */
 void history_append(const char* line);
 
 /*
- * Retrieve histnum-th histroy.
- *
- *
- *
+ * Retrieve histnum-th histroy. 0 is the latest.
+ * Returns NULL if there's no such history.
+ * The returned string is valid until next history_append().
  */
 const char* history_get(int histnum);
 
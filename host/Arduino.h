@@ -0,0 +1,110 @@
+#ifndef __HOST_ARDUINO_H_INCLUDED__
+#define __HOST_ARDUINO_H_INCLUDED__
+
+/*
+ * The part of the Arduino core the sketch uses, for a host (POSIX) build.
+ *
+ * Serial is a pair of memory buffers; host_main.cpp shuttles them to and
+ * from stdin/stdout or a pty, and the benchmarks read and write them
+ * directly. analogWrite() records the duty of each pin in host_pwm[].
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+
+typedef uint8_t byte;
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+void analogWrite(uint8_t pin, int val);
+
+#define HOST_PINS 20
+extern uint8_t       host_pwm[HOST_PINS];
+extern unsigned long host_pwm_writes;
+
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_TX_BUFFER_SIZE 64
+
+/*
+ * By default Serial is infinitely fast. With 'paced' set, it emulates
+ * the wire at the rate given to begin(): bytes go out and come in at the
+ * baud rate, write() blocks while the 64-byte TX buffer is full, and
+ * input overflowing the 64-byte RX buffer is dropped, as on the device.
+ * Either way, the host side honors XON/XOFF from the sketch, like a tty
+ * with IXON, and doesn't pass them in 'tx'.
+ */
+class HostSerial {
+public:
+    std::string rx;  /* received; not read by the sketch yet */
+    std::string tx;  /* written by the sketch, and on the wire */
+    size_t      rxpos = 0;
+
+    bool          paced   = false;
+    unsigned long baud    = 9600;
+    unsigned long dropped = 0; /* bytes lost as the RX buffer was full */
+
+    void begin(unsigned long rate) { if ( on_begin ) on_begin(); baud = rate; }
+    void end(void) {}
+    int available(void) { pump(); return rx.size() - rxpos; }
+    int availableForWrite(void);
+    int peek(void) { pump(); return ( rxpos < rx.size() ) ? (uint8_t)rx[rxpos] : -1; }
+    int read(void);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t* buf, size_t n);
+    size_t write(const char* buf, size_t n) { return write((const uint8_t*)buf, n); }
+    void flush(void);
+    operator bool() { return true; }
+
+    /* host side */
+    void feed(const char* buf, size_t n);
+    void feed(const std::string& s) { feed(s.data(), s.size()); }
+    size_t sending(void) { return wire.size(); } /* fed, but not received yet */
+    void pump(void);
+    void (*on_begin)(void) = NULL; /* before the rate changes, to take 'tx' */
+
+private:
+    bool ixon(char c);
+
+    std::string   txq;           /* TX buffer */
+    std::string   wire;          /* fed by the host, not on the wire yet */
+    bool          stopped = false; /* XOFF received by the host */
+    unsigned long tx_at = 0;
+    unsigned long rx_at = 0;
+};
+extern HostSerial Serial;
+
+char* ultoa(unsigned long val, char* buf, int radix);
+char* ltoa(long val, char* buf, int radix);
+char* utoa(unsigned int val, char* buf, int radix);
+char* itoa(int val, char* buf, int radix);
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t*)(p))
+#define pgm_read_word(p)    (*(const uint16_t*)(p))
+#define pgm_read_dword(p)   (*(const uint32_t*)(p))
+#define pgm_read_ptr(p)     (*(void* const*)(p))
+
+#define constrain(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* the sketch */
+void setup(void);
+void loop(void);
+
+#endif/*__HOST_ARDUINO_H_INCLUDED__*/
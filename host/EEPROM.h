@@ -0,0 +1,40 @@
+#ifndef __HOST_EEPROM_H_INCLUDED__
+#define __HOST_EEPROM_H_INCLUDED__
+
+/*
+ * 1KB of EEPROM (as ATmega328) in memory. host_eeprom_load()/_save()
+ * keep it in a file across runs.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#define HOST_EEPROM_SIZE 1024
+
+struct EEPROMClass {
+    uint8_t       mem[HOST_EEPROM_SIZE];
+    unsigned long writes = 0;
+
+    EEPROMClass() { memset(mem, 0xFF, sizeof(mem)); }
+    uint8_t read(int addr) { return mem[addr]; }
+    void write(int addr, uint8_t val) { mem[addr] = val; writes++; }
+    void update(int addr, uint8_t val) { if ( mem[addr] != val ) write(addr, val); }
+    uint16_t length(void) { return sizeof(mem); }
+
+    template<typename T> T& get(int addr, T& t) {
+        memcpy(&t, &mem[addr], sizeof(t));
+        return t;
+    }
+    template<typename T> const T& put(int addr, const T& t) {
+        const uint8_t* p = (const uint8_t*)&t;
+        for ( size_t i = 0;  i < sizeof(t);  i++ ) {
+            update(addr + i, p[i]);
+        }
+        return t;
+    }
+};
+extern EEPROMClass EEPROM;
+
+bool host_eeprom_load(const char* path);
+bool host_eeprom_save(const char* path);
+
+#endif/*__HOST_EEPROM_H_INCLUDED__*/
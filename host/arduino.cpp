@@ -0,0 +1,206 @@
+/*
+ * Host implementation of the Arduino core subset in Arduino.h / EEPROM.h
+ */
+#include "Arduino.h"
+#include "EEPROM.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+HostSerial    Serial;
+EEPROMClass   EEPROM;
+uint8_t       host_pwm[HOST_PINS];
+unsigned long host_pwm_writes;
+
+
+static unsigned long long now_us(void)
+{
+    static unsigned long long t0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long long t = (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if ( t0 == 0 ) {
+        t0 = t;
+    }
+    return t - t0;
+}
+
+unsigned long millis(void) { return now_us() / 1000; }
+unsigned long micros(void) { return now_us(); }
+void delay(unsigned long ms) { usleep(ms * 1000); }
+void delayMicroseconds(unsigned int us) { usleep(us); }
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+void analogWrite(uint8_t pin, int val)
+{
+    if ( pin < HOST_PINS ) {
+        host_pwm[pin] = val;
+    }
+    host_pwm_writes++;
+}
+
+
+int HostSerial::read(void)
+{
+    pump();
+    if ( rxpos >= rx.size() ) {
+        return -1;
+    }
+    int c = (uint8_t)rx[rxpos++];
+    if ( rxpos == rx.size() ) {
+        rx.clear();
+        rxpos = 0;
+    }
+    return c;
+}
+
+int HostSerial::availableForWrite(void)
+{
+    pump();
+    return paced ? SERIAL_TX_BUFFER_SIZE - 1 - txq.size() : SERIAL_TX_BUFFER_SIZE - 1;
+}
+
+/* the host tty with IXON consumes XON/XOFF */
+bool HostSerial::ixon(char c)
+{
+    if ( c == 0x13 || c == 0x11 ) {
+        stopped = ( c == 0x13 );
+        return true;
+    }
+    return false;
+}
+
+size_t HostSerial::write(const uint8_t* buf, size_t n)
+{
+    if ( ! paced ) {
+        for ( size_t i = 0;  i < n;  i++ ) {
+            if ( ! ixon(buf[i]) ) {
+                tx += (char)buf[i];
+            }
+        }
+        return n;
+    }
+    for ( size_t i = 0;  i < n;  i++ ) {
+        while ( txq.size() >= SERIAL_TX_BUFFER_SIZE - 1 ) {
+            usleep(50);
+            pump();
+        }
+        txq += (char)buf[i];
+    }
+    return n;
+}
+
+void HostSerial::flush(void)
+{
+    while ( paced && ! txq.empty() ) {
+        usleep(50);
+        pump();
+    }
+}
+
+void HostSerial::feed(const char* buf, size_t n)
+{
+    wire.append(buf, n);
+    pump();
+}
+
+void HostSerial::pump(void)
+{
+    if ( ! paced ) {
+        /* instantly, as much as the RX buffer takes */
+        size_t room = SERIAL_RX_BUFFER_SIZE - 1 - (rx.size() - rxpos);
+        if ( ! stopped && room > 0 && ! wire.empty() ) {
+            rx.append(wire, 0, room);
+            wire.erase(0, room);
+        }
+        return;
+    }
+    unsigned long now = micros();
+    unsigned long byte_us = 10000000UL / baud;
+
+    /* device -> host */
+    while ( ! txq.empty() && now - tx_at >= byte_us ) {
+        tx_at += byte_us;
+        char c = txq[0];
+        txq.erase(0, 1);
+        if ( ! ixon(c) ) {
+            tx += c;
+        }
+    }
+    if ( txq.empty() ) {
+        tx_at = now;
+    }
+
+    /* host -> device */
+    while ( ! wire.empty() && ! stopped && now - rx_at >= byte_us ) {
+        rx_at += byte_us;
+        if ( rx.size() - rxpos < SERIAL_RX_BUFFER_SIZE - 1 ) {
+            rx += wire[0];
+        } else {
+            dropped++;
+        }
+        wire.erase(0, 1);
+    }
+    if ( wire.empty() || stopped ) {
+        rx_at = now;
+    }
+}
+
+
+static char* radix_str(unsigned long val, char* buf, int radix)
+{
+    char tmp[sizeof(val) * 8 + 1];
+    int  n = 0;
+
+    do {
+        int d = val % radix;
+        tmp[n++] = ( d < 10 ) ? '0' + d : 'a' + d - 10;
+        val /= radix;
+    } while ( val );
+    for ( int i = 0;  i < n;  i++ ) {
+        buf[i] = tmp[n - 1 - i];
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+char* ultoa(unsigned long val, char* buf, int radix) { return radix_str(val, buf, radix); }
+char* utoa(unsigned int val, char* buf, int radix) { return radix_str(val, buf, radix); }
+
+char* ltoa(long val, char* buf, int radix)
+{
+    if ( val < 0 && radix == 10 ) {
+        buf[0] = '-';
+        radix_str(-(unsigned long)val, buf + 1, radix);
+        return buf;
+    }
+    return radix_str(val, buf, radix);
+}
+
+char* itoa(int val, char* buf, int radix) { return ltoa(val, buf, radix); }
+
+
+bool host_eeprom_load(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if ( fp == NULL ) {
+        return false;
+    }
+    bool ok = ( fread(EEPROM.mem, 1, sizeof(EEPROM.mem), fp) == sizeof(EEPROM.mem) );
+    fclose(fp);
+    return ok;
+}
+
+bool host_eeprom_save(const char* path)
+{
+    FILE* fp = fopen(path, "wb");
+    if ( fp == NULL ) {
+        return false;
+    }
+    bool ok = ( fwrite(EEPROM.mem, 1, sizeof(EEPROM.mem), fp) == sizeof(EEPROM.mem) );
+    return ( fclose(fp) == 0 ) && ok;
+}
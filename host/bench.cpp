@@ -0,0 +1,301 @@
+/*
+ * Microbenchmarks of picoshell and the shell commands, on the host.
+ *
+ *   bench [-t ms_per_benchmark]
+ *
+ * picoshell.cpp is included here, not linked, so that its internals
+ * (find_command_entry(), the registry, the line editor) can be measured
+ * directly. The sketch (shell.ino and all) is linked as it is, and its
+ * output goes to Serial.tx, where the bytes are counted.
+ *
+ * ns/op are of the host CPU, so only compare them among runs on the same
+ * machine; bytes per keystroke are exactly what the device would send.
+ */
+#include "Arduino.h"
+#include "../picoshell.cpp"
+#include "../brink.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+void shell_setup(void);
+
+static long bench_ms = 200;
+static volatile uintptr_t sink; /* keeps results from being optimized out */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Run fn() in batches until bench_ms has passed, and print ns per call.
+ */
+template<typename F>
+static void bench(const char* name, F fn)
+{
+    unsigned long n = 0;
+    unsigned long batch = 64;
+    double start = now_ns();
+    double elapsed;
+
+    do {
+        for ( unsigned long i = 0;  i < batch;  i++ ) {
+            fn();
+        }
+        n += batch;
+        elapsed = now_ns() - start;
+        if ( elapsed < bench_ms * 1e5 ) {
+            batch *= 2;
+        }
+    } while ( elapsed < bench_ms * 1e6 );
+
+    printf("  %-40s %9.1f ns/op\n", name, elapsed / n);
+}
+
+
+/* ************************************************************************* *
+ *     Parser
+ * ************************************************************************* */
+static const char* const parse_lines[][2] = {
+    { "short",          "rgb 999" },
+    { "4 args",         "rgb 255 128 0" },
+    { "quoted",         "echo \"hello world\" 'a b' c\\ d" },
+    { "8 args, spaces", "  fade   1  2   3    500 a b c  " },
+    { "two commands",   "rgb 255 0 0; fade 0 0 255 1000" },
+};
+
+static void bench_parse(void)
+{
+    printf("msh_parse_line()\n");
+    for ( size_t i = 0;  i < sizeof(parse_lines) / sizeof(parse_lines[0]);  i++ ) {
+        const char* line = parse_lines[i][1];
+        bench(parse_lines[i][0], [line] {
+            int   argc;
+            char* argv[MSH_CMDARGS_MAX];
+            char  argbuf[MSH_CMDLINE_CHAR_MAX];
+            sink += (uintptr_t)msh_parse_line(line, argbuf, &argc, argv) + argc;
+        });
+    }
+
+    printf("msh_parse_line_inplace() (including a copy of the line)\n");
+    for ( size_t i = 0;  i < sizeof(parse_lines) / sizeof(parse_lines[0]);  i++ ) {
+        const char* line = parse_lines[i][1];
+        size_t len = strlen(line) + 1;
+        bench(parse_lines[i][0], [line, len] {
+            int   argc;
+            char* argv[MSH_CMDARGS_MAX];
+            char  linebuf[MSH_CMDLINE_CHAR_MAX];
+            memcpy(linebuf, line, len);
+            sink += (uintptr_t)msh_parse_line_inplace(linebuf, &argc, argv) + argc;
+        });
+    }
+}
+
+
+/* ************************************************************************* *
+ *     Command lookup
+ * ************************************************************************* */
+static void bench_find(void)
+{
+    /* All the registered commands as one table, for find_command_entry() */
+    static msh_command_entry table[MSH_COMMANDS_MAX + 1];
+    for ( int i = 0;  i < registry_count;  i++ ) {
+        table[i] = *registry[i];
+    }
+    table[registry_count].name = NULL;
+
+    const char* first = table[0].name;
+    const char* last  = table[registry_count - 1].name;
+    char name[32];
+
+    printf("find_command_entry() over %d commands (linear)\n", registry_count);
+    strcpy(name, first);
+    bench("first", [&name] { sink += (uintptr_t)find_command_entry(table, name); });
+    strcpy(name, last);
+    bench("last",  [&name] { sink += (uintptr_t)find_command_entry(table, name); });
+    strcpy(name, "nosuchcmd");
+    bench("not found", [&name] { sink += (uintptr_t)find_command_entry(table, name); });
+
+    printf("msh_find_command() over %d commands (registry)\n", registry_count);
+    strcpy(name, first);
+    bench("first", [&name] { sink += (uintptr_t)msh_find_command(name); });
+    strcpy(name, last);
+    bench("last",  [&name] { sink += (uintptr_t)msh_find_command(name); });
+    strcpy(name, "nosuchcmd");
+    bench("not found", [&name] { sink += (uintptr_t)msh_find_command(name); });
+}
+
+
+/* ************************************************************************* *
+ *     History
+ * ************************************************************************* */
+#ifdef MSH_CONFIG_CMDHISTORY
+static void bench_history(void)
+{
+    static const char* const lines[] = {
+        "rgb 255 0 0", "fade 0 0 255 1000", "pattern breathe", "bright 128",
+        "echo hello world", "rgb 999", "save", "help rgb",
+    };
+    const size_t nlines = sizeof(lines) / sizeof(lines[0]);
+    size_t i = 0;
+
+    printf("history (%d bytes)\n", MSH_CMD_HISTORY_BYTES);
+    bench("history_append() full, dropping oldest", [&] {
+        history_append(lines[i++ % nlines]);
+    });
+    bench("history_append() same as the latest", [&] {
+        history_append(lines[(i - 1) % nlines]);
+    });
+
+    int count = 0;
+    while ( history_get(count) != NULL ) {
+        count++;
+    }
+    char name[64];
+    bench("history_get(0)", [] { sink += (uintptr_t)history_get(0); });
+    snprintf(name, sizeof(name), "history_get(%d), the oldest", count - 1);
+    bench(name, [count] { sink += (uintptr_t)history_get(count - 1); });
+}
+#endif
+
+
+/* ************************************************************************* *
+ *     Output bytes per editing keystroke
+ * ************************************************************************* */
+#define CTRL(c) MSH_CTRL_KEY(c)
+
+static size_t feed_keys(const char* keys, size_t len)
+{
+    Serial.tx.clear();
+    for ( size_t i = 0;  i < len;  i++ ) {
+        msh_feed_char((unsigned char)keys[i]);
+        pico_flush();
+    }
+    return Serial.tx.size();
+}
+
+/* Discard the line being editted, and put 'text' with the cursor at 'pos' */
+static void edit_setup(const char* text, int pos)
+{
+    char keys[MSH_CMDLINE_CHAR_MAX + 4];
+    int  len = strlen(text);
+
+    feed_keys("\003", 1);
+    msh_poll(); /* the prompt; not to be counted in the keystrokes */
+    pico_flush();
+    feed_keys(text, len);
+    for ( int i = len;  i > pos;  i-- ) {
+        keys[len - i] = CTRL('b');
+    }
+    feed_keys(keys, len - pos);
+}
+
+static void keystroke(const char* name, const char* text, int pos,
+                      const char* keys, size_t len, int strokes)
+{
+    edit_setup(text, pos);
+    size_t bytes = feed_keys(keys, len);
+    printf("  %-40s %9.1f bytes/key\n", name, (double)bytes / strokes);
+}
+
+static const char line40[] = "fade 255 255 255 1000; rgb 0 0 0; save";
+
+static void bench_keystrokes(void)
+{
+    static const char* const term[] = { "dumb", "vt100" };
+
+    msh_set_echo(1);
+#ifdef MSH_CONFIG_CMDHISTORY
+    history_append(line40);
+#endif
+    for ( int vt100 = 0;  vt100 < 2;  vt100++ ) {
+        msh_set_vt100(vt100);
+        printf("output per keystroke, term %s (%d chars on line)\n",
+               term[vt100], (int)sizeof(line40) - 1);
+
+        keystroke("type at the end", "", 0, "abcdefghij", 10, 10);
+        keystroke("type in the middle", line40, 20, "abcdefghij", 10, 10);
+        keystroke("backspace in the middle", line40, 20,
+                  "\b\b\b\b\b\b\b\b\b\b", 10, 10);
+        keystroke("delete in the middle", line40, 20,
+                  "\004\004\004\004\004\004\004\004\004\004", 10, 10);
+        keystroke("cursor left (^B)", line40, 20,
+                  "\002\002\002\002\002\002\002\002\002\002", 10, 10);
+        keystroke("cursor left (ESC [ D)", line40, 20,
+                  "\033[D\033[D\033[D\033[D\033[D", 15, 5);
+        keystroke("line head (^A) from the end", line40, sizeof(line40) - 1,
+                  "\001", 1, 1);
+        keystroke("kill line (^U)", line40, sizeof(line40) - 1, "\025", 1, 1);
+#ifdef MSH_CONFIG_CMDHISTORY
+        keystroke("history recall (^P)", "rgb 0 0 0", 9, "\020", 1, 1);
+        keystroke("history recall (ESC [ A)", "rgb 0 0 0", 9, "\033[A", 3, 1);
+#endif
+        keystroke("delete (ESC [ 3 ~)", line40, 20, "\033[3~", 4, 1);
+    }
+    feed_keys("\003", 1);
+}
+
+
+/* ************************************************************************* *
+ *     A command list, parsed at every run or compiled into a macro
+ * ************************************************************************* */
+static void bench_macro(void)
+{
+    static const char list[] = "rgb 255 0 0; rgb 0 0 255; bright 255";
+    char body[MSH_CMDLINE_CHAR_MAX];
+
+    printf("'%s'\n", list);
+    bench("parsed and looked up each time", [] {
+        char  line[sizeof(list)];
+        char* linep = line;
+        char* argv[MSH_CMDARGS_MAX];
+        int   argc;
+        memcpy(line, list, sizeof(list));
+        while ( 1 ) {
+            char* next = msh_parse_line_inplace(linep, &argc, argv);
+            sink += msh_exec_command(argc, (const char**)argv);
+            if ( next == linep ) {
+                break;
+            }
+            linep = next;
+        }
+    });
+    snprintf(body, sizeof(body), "{%s}", list);
+    macro_define("bench", body, false);
+    bench("macro (def bench { ... })", [] { sink += macro_run("bench"); });
+    macro_delete("bench");
+}
+
+
+int main(int argc, char** argv)
+{
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "t:")) != -1 ) {
+        switch ( opt ) {
+            case 't':
+                bench_ms = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t ms_per_benchmark]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    shell_setup();
+    Serial.tx.clear();
+
+    bench_parse();
+    bench_find();
+#ifdef MSH_CONFIG_CMDHISTORY
+    bench_history();
+#endif
+    bench_keystrokes();
+    bench_macro();
+    return 0;
+}
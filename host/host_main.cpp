@@ -0,0 +1,277 @@
+/*
+ * brink_host - run the sketch on a Linux host.
+ *
+ *   brink_host [-p] [-s] [-v] [-e eeprom.bin] [-t ms]
+ *
+ * The serial port is stdin/stdout (raw, if a terminal; Ctrl-] quits),
+ * or with -p a new pseudo-terminal, whose name is printed, so that
+ * libbrink or a terminal program can connect to it as to a device.
+ * On a pty, bytes are lost both ways while the speed set on the pty by
+ * the client differs from the rate given to Serial.begin(), as on a
+ * serial line at the wrong baud rate.
+ * -s paces Serial at the baud rate with 64-byte buffers like the device.
+ * -v logs LED changes and the frames shown on the LED strip to stderr;
+ * -e keeps the EEPROM in a file.
+ * When stdin is not a terminal, runs until EOF, and -t ms more.
+ */
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "../brink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define LED_PIN_R  9
+#define LED_PIN_G 10
+#define LED_PIN_B 11
+
+static volatile sig_atomic_t quit;
+static struct termios saved_tio;
+static bool raw_tty;
+
+static void on_signal(int sig)
+{
+    quit = 1;
+}
+
+static void restore_tty(void)
+{
+    if ( raw_tty ) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_tio);
+    }
+}
+
+static const struct { speed_t speed; unsigned long baud; } speeds[] = {
+    { B9600,   9600 },   { B19200,  19200 },  { B38400,   38400 },
+    { B57600,  57600 },  { B115200, 115200 }, { B230400,  230400 },
+    { B500000, 500000 }, { B1000000, 1000000 },
+};
+
+static unsigned long pty_baud(int fd)
+{
+    struct termios tio;
+    if ( tcgetattr(fd, &tio) < 0 ) {
+        return 0;
+    }
+    for ( size_t i = 0;  i < sizeof(speeds) / sizeof(speeds[0]);  i++ ) {
+        if ( speeds[i].speed == cfgetospeed(&tio) ) {
+            return speeds[i].baud;
+        }
+    }
+    return 0;
+}
+
+static void set_pty_baud(int fd, unsigned long baud)
+{
+    struct termios tio;
+    for ( size_t i = 0;  i < sizeof(speeds) / sizeof(speeds[0]);  i++ ) {
+        if ( speeds[i].baud == baud && tcgetattr(fd, &tio) == 0 ) {
+            cfsetspeed(&tio, speeds[i].speed);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+    }
+}
+
+static int  out = STDOUT_FILENO;
+static bool use_pty;
+static unsigned long garbled;
+
+/* Send out what the sketch wrote. Returns false if the write failed. */
+static bool send_tx(void)
+{
+    if ( use_pty && ! Serial.tx.empty() && pty_baud(out) != Serial.baud ) {
+        garbled += Serial.tx.size();
+        Serial.tx.clear();
+    }
+    if ( ! Serial.tx.empty() ) {
+        if ( write(out, Serial.tx.data(), Serial.tx.size()) < 0 && ! use_pty ) {
+            return false;
+        }
+        Serial.tx.clear();
+    }
+    return true;
+}
+
+/* what's on the wire went at the old rate */
+static void on_begin(void)
+{
+    send_tx();
+}
+
+/*
+ * The LED strip driver: keeps the frame shown last.
+ */
+static uint8_t strip_grb[STRIP_PIXELS * 3];
+static unsigned long strip_shows;
+
+static void strip_record(const uint8_t* grb, uint8_t n)
+{
+    memcpy(strip_grb, grb, n * 3);
+    strip_shows++;
+}
+
+static const strip_driver_t strip_recorder = { NULL, strip_record };
+
+/* log a frame as runs of a color, e.g. "0-15 ff0000 16-59 000000" */
+static void log_strip(void)
+{
+    fprintf(stderr, "%8lu ms  show", millis());
+    for ( int i = 0;  i < STRIP_PIXELS;  ) {
+        const uint8_t* p = &strip_grb[i * 3];
+        int j = i + 1;
+        while ( j < STRIP_PIXELS && memcmp(&strip_grb[j * 3], p, 3) == 0 ) {
+            j++;
+        }
+        if ( j - i > 1 ) {
+            fprintf(stderr, " %d-%d", i, j - 1);
+        } else {
+            fprintf(stderr, " %d", i);
+        }
+        fprintf(stderr, " %02x%02x%02x", p[1], p[0], p[2]);
+        i = j;
+    }
+    fprintf(stderr, "\r\n");
+}
+
+static int open_pty(void)
+{
+    struct termios tio;
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if ( master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 ) {
+        perror("pty");
+        exit(1);
+    }
+    /* Hold the slave open and raw, so nothing is echoed between clients */
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if ( slave < 0 || tcgetattr(slave, &tio) < 0 ) {
+        perror(ptsname(master));
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    printf("%s\n", ptsname(master));
+    fflush(stdout);
+    return master;
+}
+
+int main(int argc, char** argv)
+{
+    const char* eeprom_file = NULL;
+    bool verbose = false;
+    long linger_ms = 100;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "psve:t:")) != -1 ) {
+        switch ( opt ) {
+            case 'p': use_pty = true; break;
+            case 's': Serial.paced = true; break;
+            case 'v': verbose = true; break;
+            case 'e': eeprom_file = optarg; break;
+            case 't': linger_ms = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-p] [-s] [-v] [-e eeprom.bin] [-t ms]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    int in  = STDIN_FILENO;
+    if ( use_pty ) {
+        in = out = open_pty();
+    } else if ( isatty(in) && tcgetattr(in, &saved_tio) == 0 ) {
+        struct termios tio = saved_tio;
+        cfmakeraw(&tio);
+        tcsetattr(in, TCSANOW, &tio);
+        raw_tty = true;
+        atexit(restore_tty);
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ( eeprom_file ) {
+        host_eeprom_load(eeprom_file);
+    }
+    unsigned long eeprom_writes = EEPROM.writes;
+    uint8_t led[3] = { 0, 0, 0 };
+    bool eof = false;
+    unsigned long eof_ms = 0;
+
+    unsigned long shows = 0;
+
+    Serial.on_begin = on_begin;
+    strip_set_driver(&strip_recorder);
+    setup();
+    if ( use_pty ) {
+        set_pty_baud(in, Serial.baud);
+    }
+    while ( ! quit ) {
+        struct pollfd pfd = { in, POLLIN, 0 };
+        if ( ! eof && poll(&pfd, 1, 1) > 0 ) {
+            char buf[256];
+            ssize_t n = read(in, buf, sizeof(buf));
+            if ( n > 0 ) {
+                if ( raw_tty && memchr(buf, 0x1d, n) ) {
+                    break; /* Ctrl-] */
+                }
+                if ( use_pty && pty_baud(in) != Serial.baud ) {
+                    garbled += n;
+                } else {
+                    Serial.feed(buf, n);
+                }
+            } else if ( n == 0 || errno != EINTR ) {
+                if ( use_pty ) {
+                    usleep(1000); /* no client connected */
+                } else {
+                    eof    = true;
+                    eof_ms = millis();
+                }
+            }
+        } else if ( eof ) {
+            usleep(1000);
+        }
+
+        loop();
+
+        if ( ! send_tx() ) {
+            break;
+        }
+        if ( verbose && ( host_pwm[LED_PIN_R] != led[0]
+                          || host_pwm[LED_PIN_G] != led[1]
+                          || host_pwm[LED_PIN_B] != led[2] ) ) {
+            led[0] = host_pwm[LED_PIN_R];
+            led[1] = host_pwm[LED_PIN_G];
+            led[2] = host_pwm[LED_PIN_B];
+            fprintf(stderr, "%8lu ms  pwm %3d %3d %3d\r\n", millis(), led[0], led[1], led[2]);
+        }
+        if ( verbose && strip_shows != shows ) {
+            log_strip();
+            shows = strip_shows;
+        }
+        if ( eeprom_file && EEPROM.writes != eeprom_writes ) {
+            host_eeprom_save(eeprom_file);
+            eeprom_writes = EEPROM.writes;
+        }
+        if ( eof && ! Serial.available() && ! Serial.sending()
+             && millis() - eof_ms >= (unsigned long)linger_ms ) {
+            break;
+        }
+    }
+    Serial.flush();
+    if ( ! send_tx() ) {
+        return 1;
+    }
+    if ( verbose ) {
+        fprintf(stderr, "rx dropped %lu\r\n", Serial.dropped);
+        if ( use_pty ) {
+            fprintf(stderr, "lost to baud rate mismatch %lu\r\n", garbled);
+        }
+    }
+    return 0;
+}
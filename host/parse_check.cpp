@@ -0,0 +1,290 @@
+/*
+ * Checks the table driven parser against the parser it replaced.
+ *
+ *   parse_check [-n lines_per_alphabet] [-s seed]
+ *
+ * ref_parse_line() below is read_token() and parse_line() as they were
+ * before the state machine, unchanged but for the names. Random lines are
+ * parsed by both, into a separate buffer and in place, and argc, argv[]
+ * and the position returned must be the same. Braces are in the alphabets
+ * too, as the parser must take them as plain characters; only 'def' takes
+ * '{...}', before the parser (see parse_def() in shell.ino).
+ *
+ * picoshell.cpp is included, as in bench.cpp, to reach parse_line().
+ */
+#include "Arduino.h"
+#include "../picoshell.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+/* ************************************************************************* *
+ *     The old parser
+ * ************************************************************************* */
+typedef struct {
+    const char* readpos;
+    char*       writepos;
+    char        stopchar;
+} ref_state_t;
+
+static int ref_read_token(ref_state_t* pstate)
+{
+    int   readcount  = 0;
+    bool  is_squoted = false;
+    bool  is_dquoted = false;
+
+    while ( 1 ) {
+        char ch = *pstate->readpos;
+
+        if ( ch == '\0' ) {
+            break;
+        }
+        readcount++;
+
+        if ( is_squoted || is_dquoted ) {
+            if (   (is_squoted  &&  ch == '\'')
+                || (is_dquoted  &&  ch == '"' )  )  {
+                is_squoted = false;
+                is_dquoted = false;
+            } else {
+                *pstate->writepos++ = ch;
+            }
+        }
+        else
+        {
+            if ( ch == '\'' ) {
+                is_squoted = true;
+            }
+            else
+            if ( ch == '"' ) {
+                is_dquoted = true;
+            }
+            else
+            if ( ch == MSH_CMD_ESCAPE_CHAR ) {
+                pstate->readpos++;
+                ch = *pstate->readpos;
+                if ( ! isprint((unsigned)ch) ) {
+                    return -1;
+                } else {
+                    readcount++;
+                    *pstate->writepos++ = ch;
+                }
+            }
+            else
+            if ( isspace((unsigned)ch)
+                 || ch == MSH_CMD_SEP_CHAR )  {
+                readcount--;
+                break;
+            }
+            else
+            if ( isprint((unsigned)ch) ) {
+                *pstate->writepos++ = ch;
+            }
+            else
+            {
+                return -1;
+            }
+        }
+        pstate->readpos++;
+    }
+
+    if ( is_squoted || is_dquoted ) {
+        return -1;
+    } else {
+        pstate->stopchar = *pstate->readpos;
+        *pstate->writepos++ = '\0';
+        return readcount;
+    }
+}
+
+static const char*
+ref_parse_line(const char* cmdline, char* argvbuf, int* pargc, char** argv)
+{
+    ref_state_t state;
+    state.readpos  = cmdline;
+    state.writepos = argvbuf;
+
+    *pargc = 0;
+    argv[0] = argvbuf;
+
+    while ( *state.readpos != '\0' ) {
+        while ( isspace((unsigned)*state.readpos) ) {
+            state.readpos++;
+        }
+
+        if ( *pargc < MSH_CMDARGS_MAX ) {
+            argv[*pargc] = state.writepos;
+        }
+        else
+        if ( *state.readpos != '\0' && *state.readpos != MSH_CMD_SEP_CHAR ) {
+            return NULL;
+        }
+
+        int ret = ref_read_token(&state);
+
+        if ( ret < 0 ) {
+            return NULL;
+        }
+        else
+        if ( ret == 0 ) {
+            switch ( state.stopchar ) {
+                case '\0':
+                    return cmdline;
+                case MSH_CMD_SEP_CHAR:
+                    return (state.readpos+1);
+                default:
+                    return NULL;
+            }
+        }
+        else
+        {
+            (*pargc)++;
+            if ( state.stopchar == '\0' ) {
+                return cmdline;
+            }
+            if ( state.stopchar == MSH_CMD_SEP_CHAR ) {
+                state.readpos++;
+                return (state.readpos);
+            }
+            else
+            if ( isspace((unsigned)state.stopchar) ) {
+                state.readpos++;
+                continue;
+            }
+            else {
+                return NULL;
+            }
+        }
+    }
+    return cmdline;
+}
+
+
+/* ************************************************************************* *
+ *     Comparing them
+ * ************************************************************************* */
+typedef const char* (*parse_fn)(const char*, char*, int*, char**);
+
+typedef struct {
+    bool  ok;
+    long  next;     /* offset of the position returned */
+    int   argc;
+    char  argv[MSH_CMDARGS_MAX][MSH_CMDLINE_CHAR_MAX];
+} result_t;
+
+static void run(parse_fn parse, const char* line, bool inplace, result_t* r)
+{
+    char  linebuf[MSH_CMDLINE_CHAR_MAX];
+    char  argbuf[MSH_CMDLINE_CHAR_MAX];
+    char* argv[MSH_CMDARGS_MAX];
+    char* buf = inplace ? linebuf : argbuf;
+
+    strcpy(linebuf, line);
+    memset(argbuf, 0, sizeof(argbuf)); /* the old one left it as is for "" */
+    memset(r, 0, sizeof(*r));
+    const char* ret = parse(linebuf, buf, &r->argc, argv);
+    r->ok = ( ret != NULL );
+    if ( ! r->ok ) {
+        return; /* argc and argv[] are undefined on errors */
+    }
+    r->next = ret - linebuf;
+    for ( int i = 0;  i < r->argc;  i++ ) {
+        strcpy(r->argv[i], argv[i]);
+    }
+    if ( r->argc == 0 ) {
+        strcpy(r->argv[0], argv[0]); /* callers test strlen(argv[0]) */
+    }
+}
+
+static bool same(const result_t* a, const result_t* b)
+{
+    if ( a->ok != b->ok ) {
+        return false;
+    }
+    if ( ! a->ok ) {
+        return true;
+    }
+    if ( a->next != b->next || a->argc != b->argc ) {
+        return false;
+    }
+    for ( int i = 0;  i < a->argc || i == 0;  i++ ) {
+        if ( strcmp(a->argv[i], b->argv[i]) != 0 ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_result(const char* name, const result_t* r)
+{
+    if ( ! r->ok ) {
+        printf("  %s: error\n", name);
+        return;
+    }
+    printf("  %s: next %ld, argc %d:", name, r->next, r->argc);
+    for ( int i = 0;  i < r->argc || i == 0;  i++ ) {
+        printf(" '%s'", r->argv[i]);
+    }
+    printf("\n");
+}
+
+static const char* const alphabets[] = {
+    "ab  ;{}",
+    "ab \t;'\"\\{}",
+    " ;'\"\\\t\001xyz0123~!{}",
+};
+
+int main(int argc, char** argv)
+{
+    long n = 100000;
+    int  opt;
+    int  failed = 0;
+
+    srand(1);
+    while ( (opt = getopt(argc, argv, "n:s:")) != -1 ) {
+        switch ( opt ) {
+            case 'n':
+                n = atol(optarg);
+                break;
+            case 's':
+                srand(atoi(optarg));
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n lines_per_alphabet] [-s seed]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    for ( size_t a = 0;  a < sizeof(alphabets) / sizeof(alphabets[0]);  a++ ) {
+        const char* chars  = alphabets[a];
+        size_t      nchars = strlen(chars);
+
+        for ( long i = 0;  i < n && failed < 10;  i++ ) {
+            char line[MSH_CMDLINE_CHAR_MAX];
+            int  len = rand() % (MSH_CMDLINE_CHAR_MAX - 1);
+
+            for ( int j = 0;  j < len;  j++ ) {
+                line[j] = chars[rand() % nchars];
+            }
+            line[len] = '\0';
+
+            for ( int inplace = 0;  inplace < 2;  inplace++ ) {
+                result_t ref, cur;
+                run(ref_parse_line, line, inplace, &ref);
+                run(parse_line, line, inplace, &cur);
+                if ( ! same(&ref, &cur) ) {
+                    printf("differ%s: '%s'\n", inplace ? " in place" : "", line);
+                    print_result("old", &ref);
+                    print_result("new", &cur);
+                    failed++;
+                }
+            }
+        }
+    }
+    printf("%ld lines x %d alphabets: %s\n", n,
+           (int)(sizeof(alphabets) / sizeof(alphabets[0])),
+           failed ? "FAILED" : "identical");
+    return failed ? 1 : 0;
+}
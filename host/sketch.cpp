@@ -0,0 +1,19 @@
+/*
+ * The sketch as the Arduino IDE builds it: brink.ino first, then the
+ * other tabs in alphabetical order, as one translation unit.
+ * Functions used across the files are declared in brink.h.
+ */
+#include "Arduino.h"
+
+#include "../brink.ino"
+#include "../anim.ino"
+#include "../baud.ino"
+#include "../frame.ino"
+#include "../led.ino"
+#include "../macro.ino"
+#include "../mem.ino"
+#include "../persist.ino"
+#include "../sched.ino"
+#include "../shell.ino"
+#include "../stream.ino"
+#include "../strip.ino"
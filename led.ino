@@ -4,6 +4,67 @@
 #define GREEN 10
 #define BLUE  11
 
+/*
+ * On ATmega328 (Uno, Nano, ...) the OCR registers for the pins are written
+ * directly, instead of three analogWrite()s each looking up its timer:
+ *   pin  9 = OC1A, pin 10 = OC1B : Timer1, fast PWM at 1kHz, TOP=15999
+ *                                  (about 14 bits) at 16MHz
+ *   pin 11 = OC2A                : Timer2, 8-bit fast PWM at 7.8kHz, and
+ *                                  the lower 8 bits are dithered over
+ *                                  the periods, by the overflow interrupt.
+ * The interrupt is on only while the blue duty has a fraction; it takes
+ * about 45 cycles, 2.2% of the CPU at 7.8kHz, then.
+ *
+ * led_rgb() takes about 250 cycles (16us) this way, and 600 (38us) with
+ * analogWrite(); the three led_duty()s, about 100 cycles, are the same
+ * in both. These are counted from the source for avr-gcc -Os, not measured.
+ * Define LED_ANALOGWRITE to use analogWrite() anyway.
+ */
+#if defined(__AVR_ATmega328P__) && !defined(LED_ANALOGWRITE)
+#define LED_DIRECT_PWM
+#define LED_PWM_TOP  (F_CPU / 1000 - 1)
+#endif
+
+/*
+ * Gamma table, from a perceptual level (0-255) to a 16-bit duty.
+ * gamma 2.2 is approximated by 0.8x^2 + 0.2x^3, and the table is computed
+ * by the compiler and stored in flash.
+ */
+constexpr uint16_t led_gamma16(unsigned i) {
+  return (uint16_t)(65535.0 * (0.8 * (i / 255.0) * (i / 255.0)
+                             + 0.2 * (i / 255.0) * (i / 255.0) * (i / 255.0)) + 0.5);
+}
+#define LED_GAMMA4(i)   led_gamma16(i), led_gamma16(i + 1), led_gamma16(i + 2), led_gamma16(i + 3)
+#define LED_GAMMA16(i)  LED_GAMMA4(i), LED_GAMMA4(i + 4), LED_GAMMA4(i + 8), LED_GAMMA4(i + 12)
+#define LED_GAMMA64(i)  LED_GAMMA16(i), LED_GAMMA16(i + 16), LED_GAMMA16(i + 32), LED_GAMMA16(i + 48)
+
+static const uint16_t led_gamma[256] PROGMEM = {
+  LED_GAMMA64(0), LED_GAMMA64(64), LED_GAMMA64(128), LED_GAMMA64(192)
+};
+
+static uint8_t led_brightness = 255;
+
+static inline uint16_t led_duty(uint8_t level) {
+  uint16_t x = (uint16_t)level * led_brightness;
+  /* x / 255, exact up to 255 * 255, without a division call */
+  return pgm_read_word(&led_gamma[(x + 1 + (x >> 8)) >> 8]);
+}
+
+
+#ifdef LED_DIRECT_PWM
+/* The fractional part of the blue duty, added up in Timer2 overflows */
+static volatile uint8_t led_blue_hi;
+static volatile uint8_t led_blue_frac;
+
+ISR(TIMER2_OVF_vect) {
+  static uint8_t acc;
+  uint8_t sum = acc + led_blue_frac;
+  /* carry out of 8 bits makes this period one step longer */
+  OCR2A = ( sum < acc && led_blue_hi < 255 ) ? led_blue_hi + 1 : led_blue_hi;
+  acc = sum;
+}
+#endif
+
 
 void led_setup() {
   // put your setup code here, to run once:
@@ -13,18 +74,77 @@ void led_setup() {
   digitalWrite(RED, HIGH);
   digitalWrite(GREEN, HIGH);
   digitalWrite(BLUE, HIGH);
+#ifdef LED_DIRECT_PWM
+  // Timer1: fast PWM, TOP=ICR1, no prescaling; 1kHz
+  TCCR1A = _BV(WGM11);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS10);
+  ICR1   = LED_PWM_TOP;
+  // Timer2: fast PWM, TOP=0xFF, clk/8; 7.8kHz. Its interrupt is set by led_rgb()
+  TCCR2A = _BV(WGM21) | _BV(WGM20);
+  TCCR2B = _BV(CS21);
+#endif
 }
 
 void led_off() {
-  digitalWrite(RED, LOW);
-  digitalWrite(GREEN, LOW);
-  digitalWrite(BLUE, LOW);
+  led_rgb(0, 0, 0);
+}
+
+#ifdef LED_DIRECT_PWM
+/* a 16-bit duty in Timer1 ticks */
+static inline uint16_t led_ticks(uint16_t d) {
+  return ((uint32_t)d * (LED_PWM_TOP + 1)) >> 16;
 }
 
 void led_rgb(uint8_t r, uint8_t g, uint8_t b) {
-  analogWrite(RED,   r);
-  analogWrite(GREEN, g);
-  analogWrite(BLUE,  b);
+  uint16_t dr = led_ticks(led_duty(r));
+  uint16_t dg = led_ticks(led_duty(g));
+  uint16_t db = led_duty(b);
+  uint8_t  com1 = 0;
+
+  // A zero duty still makes a 1-tick pulse in fast PWM; disconnect instead.
+  if ( dr ) com1 |= _BV(COM1A1);
+  if ( dg ) com1 |= _BV(COM1B1);
+
+  // Update all the channels at once, within the same PWM period
+  uint8_t sreg = SREG;
+  cli();
+  OCR1A  = dr;
+  OCR1B  = dg;
+  TCCR1A = (TCCR1A & ~(_BV(COM1A1) | _BV(COM1B1))) | com1;
+  led_blue_hi   = db >> 8;
+  led_blue_frac = db & 0xFF;
+  OCR2A = led_blue_hi;
+  // Dither only if there's a fraction to add up
+  if ( led_blue_frac && led_blue_hi < 255 ) {
+    TIMSK2 |= _BV(TOIE2);
+  } else {
+    TIMSK2 &= ~_BV(TOIE2);
+  }
+  if ( db ) {
+    TCCR2A |= _BV(COM2A1);
+  } else {
+    TCCR2A &= ~_BV(COM2A1);
+  }
+  // Pins disconnected from the timers follow PORTB; keep them low
+  PORTB &= ~(_BV(PB1) | _BV(PB2) | _BV(PB3));
+  SREG = sreg;
 }
+#else
+void led_rgb(uint8_t r, uint8_t g, uint8_t b) {
+  analogWrite(RED,   led_duty(r) >> 8);
+  analogWrite(GREEN, led_duty(g) >> 8);
+  analogWrite(BLUE,  led_duty(b) >> 8);
+}
+#endif
 
+/*
+ * Scale all the colors given to led_rgb() by 'level' (0-255), before the
+ * gamma correction. Takes effect from the next led_rgb().
+ */
+void led_set_brightness(uint8_t level) {
+  led_brightness = level;
+}
 
+uint8_t led_get_brightness() {
+  return led_brightness;
+}
@@ -0,0 +1,105 @@
+/*
+ * Throughput of pipelined submission vs. one command per round trip.
+ *
+ *   bench [-n count] [-b baud] [-l latency_us] [-B window_bytes] [/dev/ttyXXX]
+ *
+ * Without a tty, runs against fake_device on a pseudo-terminal.
+ * Every 'echo' reply is checked, so a lost or misattributed reply fails.
+ */
+#include "brink_client.h"
+#include "fake_device.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+static int run(const std::string& tty, const brink::options& opts, int count,
+               const char* label, brink::fake_device* fake)
+{
+    using namespace std::chrono;
+    brink::client dev(tty, opts);
+    std::vector<std::future<brink::reply> > replies;
+    unsigned long dropped = fake ? fake->dropped() : 0;
+
+    steady_clock::time_point start = steady_clock::now();
+    for ( int i = 0;  i < count;  i++ ) {
+        if ( i % 2 ) {
+            replies.push_back(dev.submit("rgb " + std::to_string(i % 256) + " 0 0"));
+        } else {
+            replies.push_back(dev.submit("echo " + std::to_string(i)));
+        }
+    }
+    int errors = 0;
+    for ( int i = 0;  i < count;  i++ ) {
+        brink::reply r = replies[i].get();
+        std::string expect = ( i % 2 ) ? "" : std::to_string(i) + " \n";
+        if ( r.rc != 0 || r.output != expect ) {
+            errors++;
+        }
+    }
+    double sec = duration<double>(steady_clock::now() - start).count();
+
+    printf("%-24s %4zu %8.1f cmd/s %8.2f ms/cmd",
+           label, opts.window, count / sec, sec * 1000 / count);
+    if ( fake ) {
+        printf("  dropped %lu", fake->dropped() - dropped);
+    }
+    printf("  errors %d\n", errors);
+    return errors;
+}
+
+
+int main(int argc, char** argv)
+{
+    brink::fake_options fopts;
+    size_t window_bytes = brink::options().window_bytes;
+    int count = 200;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "n:b:l:B:")) != -1 ) {
+        switch ( opt ) {
+            case 'n': count = atoi(optarg); break;
+            case 'b': fopts.baud = atoi(optarg); break;
+            case 'l': fopts.latency_us = atoi(optarg); break;
+            case 'B': window_bytes = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-b baud] [-l latency_us] [-B window_bytes] [tty]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    std::unique_ptr<brink::fake_device> fake;
+    std::string tty;
+    if ( optind < argc ) {
+        tty = argv[optind];
+    } else {
+        fake.reset(new brink::fake_device(fopts));
+        tty = fake->tty();
+        printf("fake device at %d baud, %d us latency\n", fopts.baud, fopts.latency_us);
+    }
+
+    printf("%-24s %4s\n", "", "window");
+    int errors = 0;
+    try {
+        for ( int machine = 0;  machine < 2;  machine++ ) {
+            for ( size_t window : { 1, 8 } ) {
+                brink::options opts;
+                opts.baud         = fopts.baud;
+                opts.machine_mode = machine;
+                opts.window       = window;
+                opts.window_bytes = window_bytes;
+                errors += run(tty, opts, count,
+                              machine ? "machine mode" : "text mode", fake.get());
+            }
+        }
+    } catch ( const std::exception& e ) {
+        fprintf(stderr, "bench: %s\n", e.what());
+        return 1;
+    }
+    return errors ? 1 : 0;
+}
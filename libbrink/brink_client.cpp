@@ -0,0 +1,491 @@
+#include "brink_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+
+namespace brink {
+
+static speed_t baud_to_speed(int baud)
+{
+    switch ( baud ) {
+        case 1200:   return B1200;
+        case 2400:   return B2400;
+        case 4800:   return B4800;
+        case 9600:   return B9600;
+        case 19200:  return B19200;
+        case 38400:  return B38400;
+        case 57600:  return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 500000: return B500000;
+        case 1000000: return B1000000;
+        default:
+            throw error("unsupported baud rate: " + std::to_string(baud));
+    }
+}
+
+static std::string crlf_to_lf(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for ( size_t i = 0;  i < s.size();  i++ ) {
+        if ( s[i] == '\r' && i + 1 < s.size() && s[i + 1] == '\n' ) {
+            continue;
+        }
+        out += s[i];
+    }
+    return out;
+}
+
+
+client::client(const std::string& tty, const options& opts)
+    : opts_(opts)
+{
+    open_tty(tty);
+    if ( pipe(wakeup_) < 0 ) {
+        ::close(fd_);
+        throw error(std::string("pipe: ") + strerror(errno));
+    }
+    try {
+        synchronize();
+    } catch ( ... ) {
+        ::close(fd_);
+        ::close(wakeup_[0]);
+        ::close(wakeup_[1]);
+        throw;
+    }
+    reader_thread_ = std::thread(&client::reader, this);
+}
+
+
+client::~client()
+{
+    if ( write(wakeup_[1], "", 1) < 0 ) {
+        /* the reader stops on the next poll timeout anyway */
+    }
+    reader_thread_.join();
+    ::close(fd_);
+    ::close(wakeup_[0]);
+    ::close(wakeup_[1]);
+}
+
+
+void client::open_tty(const std::string& tty)
+{
+    struct termios tio;
+
+    fd_ = ::open(tty.c_str(), O_RDWR | O_NOCTTY);
+    if ( fd_ < 0 ) {
+        throw error(tty + ": " + strerror(errno));
+    }
+    if ( tcgetattr(fd_, &tio) < 0 ) {
+        ::close(fd_);
+        throw error(tty + ": " + strerror(errno));
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if ( opts_.flow_control ) {
+        /*
+         * The device sends XOFF when its RX buffer is half full. Bytes
+         * already queued in the USB-serial bridge still go through, so
+         * window_bytes is kept as well.
+         */
+        tio.c_iflag |= IXON;
+    }
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+    if ( tcsetattr(fd_, TCSANOW, &tio) < 0 ) {
+        ::close(fd_);
+        throw error(tty + ": " + strerror(errno));
+    }
+    try {
+        set_speed(opts_.baud);
+    } catch ( ... ) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+
+/*
+ * Set the speed of the tty, after what's written is sent.
+ */
+void client::set_speed(int baud)
+{
+    struct termios tio;
+    speed_t speed = baud_to_speed(baud);
+
+    tcdrain(fd_);
+    if ( tcgetattr(fd_, &tio) < 0 ) {
+        throw error(std::string("tcgetattr: ") + strerror(errno));
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if ( tcsetattr(fd_, TCSANOW, &tio) < 0 ) {
+        throw error(std::string("tcsetattr: ") + strerror(errno));
+    }
+}
+
+
+/*
+ * Read until 'pattern' appears in rxbuf_, and return its position.
+ * Used before the reader thread starts.
+ */
+size_t client::wait_for(const std::string& pattern, int timeout_ms)
+{
+    using namespace std::chrono;
+    steady_clock::time_point deadline =
+        steady_clock::now() + milliseconds(timeout_ms);
+
+    while ( 1 ) {
+        size_t pos = rxbuf_.find(pattern);
+        if ( pos != std::string::npos ) {
+            return pos;
+        }
+        int left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+        if ( left <= 0 ) {
+            throw error("no response from the device");
+        }
+        struct pollfd pfd = { fd_, POLLIN, 0 };
+        if ( poll(&pfd, 1, left) > 0 ) {
+            char buf[256];
+            ssize_t n = read(fd_, buf, sizeof(buf));
+            if ( n <= 0 ) {
+                throw error(std::string("read: ") + strerror(errno));
+            }
+            rxbuf_.append(buf, n);
+        }
+    }
+}
+
+
+/*
+ * Bring the shell to a known state: an empty line in human mode (or
+ * machine mode, if asked), right after the prompt, with nothing in flight.
+ */
+void client::synchronize()
+{
+    if ( opts_.boot_wait_ms > 0 ) {
+        usleep(opts_.boot_wait_ms * 1000);
+    }
+    tcflush(fd_, TCIFLUSH);
+
+    /*
+     * Ctrl-C discards a partial line, 'mode human' turns echo back on if
+     * it was off, and the output of the echo marks the sync point.
+     * The echo back of the command line itself doesn't match the marker
+     * since it's preceded by "echo " instead of a newline.
+     */
+    std::string marker = "brink-sync-" + std::to_string(getpid());
+    write_all("\x03mode human\recho " + marker + "\r");
+    size_t pos = wait_for("\r\n" + marker + " \r\n" + opts_.prompt, opts_.timeout_ms);
+    rxbuf_.erase(0, pos + marker.size() + 5 + opts_.prompt.size());
+
+    if ( opts_.machine_mode ) {
+        /* 'mode machine' is still echoed back, then answered as #0 */
+        write_all("mode machine\r");
+        pos = wait_for("#0 0\r\n", opts_.timeout_ms);
+        rxbuf_.erase(0, pos + 6);
+    }
+}
+
+
+/*
+ * Same as synchronize(), with the reader thread running: Ctrl-C, then
+ * echo a marker until it comes back as the reply. Anything else read in
+ * between, such as garbage at a wrong baud rate, is discarded. The mode
+ * of the shell is kept.
+ */
+void client::resynchronize()
+{
+    std::string marker = "brink-sync-" + std::to_string(getpid());
+
+    for ( int i = 0;  i < 3;  i++ ) {
+        {
+            std::lock_guard<std::mutex> wlock(write_mutex_);
+            write_all("\x03");
+        }
+        usleep(100 * 1000);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rxbuf_.clear();
+            machine_out_.clear();
+        }
+        std::future<reply> f = submit("echo " + marker);
+        if ( f.wait_for(std::chrono::milliseconds(opts_.timeout_ms)) == std::future_status::ready
+             && f.get().output == marker + " \n" ) {
+            return;
+        }
+        abandon();
+    }
+    fail("lost synchronization with the device");
+    throw error("lost synchronization with the device");
+}
+
+
+/*
+ * Forget the commands in flight; their replies are not coming.
+ */
+void client::abandon()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.clear();
+    pending_bytes_ = 0;
+}
+
+
+void client::set_baud(int baud, bool save)
+{
+    int old = opts_.baud;
+
+    baud_to_speed(baud); /* throws if the tty can't */
+    drain();
+    reply r = exec("baud " + std::to_string(baud) + ( save ? " save" : "" ));
+    if ( r.rc != 0 || ! r.output.empty() ) {
+        throw error("baud " + std::to_string(baud) + ": " + r.output);
+    }
+
+    /* The device switches once the reply is out; don't talk before it. */
+    usleep(10 * 1000);
+    set_speed(baud);
+    std::future<reply> f = submit("baud ok");
+    if ( f.wait_for(std::chrono::milliseconds(opts_.baud_confirm_ms / 2)) == std::future_status::ready ) {
+        r = f.get();
+        if ( r.rc == 0 && r.output.empty() ) {
+            opts_.baud = baud;
+            return;
+        }
+    }
+
+    /* The device goes back by itself; wait for it, and sync again */
+    abandon();
+    usleep(opts_.baud_confirm_ms * 1000);
+    set_speed(old);
+    resynchronize();
+    throw error("baud " + std::to_string(baud) + ": no response, back to " + std::to_string(old));
+}
+
+
+void client::write_all(const std::string& data)
+{
+    size_t done = 0;
+    while ( done < data.size() ) {
+        ssize_t n = write(fd_, data.data() + done, data.size() - done);
+        if ( n < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            throw error(std::string("write: ") + strerror(errno));
+        }
+        done += n;
+    }
+}
+
+
+void client::send(const std::string& line, callback cb)
+{
+    if ( line.find_first_of("\r\n") != std::string::npos ) {
+        throw std::invalid_argument("a command line can't contain a newline");
+    }
+    if ( opts_.machine_mode
+         && (line.find(';') != std::string::npos
+             || line.find_first_not_of(" \t") == std::string::npos) ) {
+        /* they would make no reply, or more than one */
+        throw std::invalid_argument("need exactly one command in machine mode");
+    }
+
+    std::string data = line + "\r";
+    std::lock_guard<std::mutex> wlock(write_mutex_);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&] {
+            return ! error_.empty()
+                || pending_.empty()
+                || ( pending_.size() < opts_.window
+                     && pending_bytes_ + data.size() <= opts_.window_bytes );
+        });
+        if ( ! error_.empty() ) {
+            throw error(error_);
+        }
+        pending_.push_back(pending{ data.size(), cb });
+        pending_bytes_ += data.size();
+    }
+    write_all(data);
+}
+
+
+reply client::exec(const std::string& line)
+{
+    return submit(line).get();
+}
+
+
+std::future<reply> client::submit(const std::string& line)
+{
+    std::shared_ptr<std::promise<reply> > p = std::make_shared<std::promise<reply> >();
+    std::future<reply> f = p->get_future();
+    send(line, [p](const reply& r) { p->set_value(r); });
+    return f;
+}
+
+
+void client::submit(const std::string& line, callback cb)
+{
+    send(line, cb);
+}
+
+
+void client::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&] { return pending_.empty(); });
+}
+
+
+size_t client::in_flight()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+}
+
+
+void client::reader()
+{
+    struct pollfd pfd[2] = {
+        { fd_,        POLLIN, 0 },
+        { wakeup_[0], POLLIN, 0 },
+    };
+    char buf[256];
+
+    while ( 1 ) {
+        if ( poll(pfd, 2, -1) < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            fail(std::string("poll: ") + strerror(errno));
+            return;
+        }
+        if ( pfd[1].revents ) {
+            return; /* closing */
+        }
+        ssize_t n = read(fd_, buf, sizeof(buf));
+        if ( n <= 0 ) {
+            fail(n == 0 ? "tty closed" : std::string("read: ") + strerror(errno));
+            return;
+        }
+
+        completions done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rxbuf_.append(buf, n);
+            parse(done);
+        }
+        /* callbacks may submit, so call them without the lock */
+        for ( auto& d : done ) {
+            if ( d.first ) {
+                d.first(d.second);
+            }
+        }
+        if ( ! done.empty() ) {
+            cond_.notify_all();
+        }
+    }
+}
+
+
+/*
+ * Split rxbuf_ into replies. Called with mutex_ held.
+ */
+void client::parse(completions& done)
+{
+    if ( ! opts_.machine_mode ) {
+        /*
+         * Each line sent comes back as:
+         *   <echo back>\r\n [\r\n <output>] <prompt>
+         */
+        size_t pos;
+        while ( (pos = rxbuf_.find(opts_.prompt)) != std::string::npos ) {
+            std::string seg = rxbuf_.substr(0, pos);
+            rxbuf_.erase(0, pos + opts_.prompt.size());
+
+            reply r;
+            size_t eol = seg.find("\r\n");
+            std::string out = ( eol == std::string::npos ) ? "" : seg.substr(eol + 2);
+            if ( out.compare(0, 2, "\r\n") == 0 ) {
+                out.erase(0, 2);
+            }
+            r.output = crlf_to_lf(out);
+            if ( r.output.compare(0, 18, "command not found:") == 0 ) {
+                r.rc = -1;
+            } else if ( r.output.compare(0, 12, "Syntax error") == 0 ) {
+                r.rc = -2;
+            }
+            complete(r, done);
+        }
+    }
+    else
+    {
+        /*
+         * Output lines of a command, then "#<seq> <rc>"
+         */
+        size_t eol;
+        while ( (eol = rxbuf_.find("\r\n")) != std::string::npos ) {
+            std::string line = rxbuf_.substr(0, eol);
+            rxbuf_.erase(0, eol + 2);
+
+            unsigned seq;
+            int rc;
+            char c;
+            if ( sscanf(line.c_str(), "#%u %d%c", &seq, &rc, &c) == 2 ) {
+                reply r;
+                r.rc = rc;
+                r.output.swap(machine_out_);
+                complete(r, done);
+            } else {
+                machine_out_ += line + "\n";
+            }
+        }
+    }
+}
+
+
+void client::complete(const reply& r, completions& done)
+{
+    if ( pending_.empty() ) {
+        return; /* not ours; e.g. a reset of the device */
+    }
+    done.push_back(std::make_pair(pending_.front().cb, r));
+    pending_bytes_ -= pending_.front().bytes;
+    pending_.pop_front();
+}
+
+
+void client::fail(const std::string& why)
+{
+    completions done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = why;
+        reply r;
+        r.rc = reply::RC_LINK_ERROR;
+        r.output = why;
+        while ( ! pending_.empty() ) {
+            complete(r, done);
+        }
+    }
+    for ( auto& d : done ) {
+        if ( d.first ) {
+            d.first(d.second);
+        }
+    }
+    cond_.notify_all();
+}
+
+} // namespace brink
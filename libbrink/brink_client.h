@@ -0,0 +1,131 @@
+#ifndef __BRINK_CLIENT_H_INCLUDED__
+#define __BRINK_CLIENT_H_INCLUDED__
+
+/*
+ * libbrink - Linux client for the brink text shell over a serial tty.
+ *
+ * The tty is opened once, and commands are pipelined: up to
+ * options::window commands (and options::window_bytes bytes, so that the
+ * device's RX buffer never overflows) are sent before their replies come
+ * back. Replies are matched to commands in order, by the prompt which
+ * the shell prints after each line, or by the '#<seq> <rc>' lines in
+ * machine mode.
+ *
+ *     brink::client dev("/dev/ttyACM0");
+ *     dev.exec("rgb 255 0 0");                          // synchronous
+ *     std::future<brink::reply> f = dev.submit("echo hi");
+ *     dev.submit("rgb 0 0 255", [](const brink::reply& r) { ... });
+ *     dev.drain();
+ */
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace brink {
+
+struct options {
+    int         baud         = 9600;
+    size_t      window       = 8;   /* max commands in flight */
+    size_t      window_bytes = 48;  /* max bytes in flight; RX buffer is 64 */
+    bool        flow_control = true;/* stop sending on XOFF from the device */
+    bool        machine_mode = false; /* switch the shell to 'mode machine' */
+    std::string prompt       = "LED> ";
+    int         boot_wait_ms = 0;   /* wait for a reset on open (e.g. 2000 for Uno) */
+    int         timeout_ms   = 3000;/* for the initial synchronization */
+    int         baud_confirm_ms = 2000; /* BAUD_CONFIRM_MS of the device */
+};
+
+struct reply {
+    /*
+     * Return code of the command: the command's own in machine mode.
+     * In text mode, -1 for "command not found", -2 for a syntax error,
+     * and 0 otherwise. RC_LINK_ERROR if the tty failed before the reply.
+     */
+    enum { RC_LINK_ERROR = -100 };
+    int         rc = 0;
+    std::string output; /* what the command printed, '\n' separated */
+};
+
+class error : public std::runtime_error {
+public:
+    explicit error(const std::string& what) : std::runtime_error(what) {}
+};
+
+class client {
+public:
+    typedef std::function<void(const reply&)> callback;
+
+    explicit client(const std::string& tty, const options& opts = options());
+    ~client();
+
+    client(const client&) = delete;
+    client& operator=(const client&) = delete;
+
+    /* Send a command line and wait for its reply. */
+    reply exec(const std::string& line);
+
+    /*
+     * Send a command line and return without waiting for the reply.
+     * Blocks only while the window is full.
+     */
+    std::future<reply> submit(const std::string& line);
+    void submit(const std::string& line, callback cb);
+
+    /* Wait until all the commands submitted are answered. */
+    void drain();
+
+    /* Number of commands sent but not answered yet. */
+    size_t in_flight();
+
+    /*
+     * Switch the device and the tty to another baud rate, after the
+     * commands in flight. With 'save', the device keeps the rate across
+     * reboots. If the device doesn't answer at the new rate, both go back
+     * to the current rate, and brink::error is thrown.
+     */
+    void set_baud(int baud, bool save = false);
+
+private:
+    struct pending {
+        size_t   bytes;
+        callback cb;
+    };
+
+    typedef std::deque<std::pair<callback, reply> > completions;
+
+    void open_tty(const std::string& tty);
+    void set_speed(int baud);
+    void synchronize();
+    void resynchronize();
+    void abandon();
+    size_t wait_for(const std::string& pattern, int timeout_ms);
+    void send(const std::string& line, callback cb);
+    void write_all(const std::string& data);
+    void reader();
+    void parse(completions& done);
+    void complete(const reply& r, completions& done);
+    void fail(const std::string& why);
+
+    options                 opts_;
+    int                     fd_ = -1;
+    int                     wakeup_[2] = { -1, -1 };
+    std::thread             reader_thread_;
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+    std::deque<pending>     pending_;
+    size_t                  pending_bytes_ = 0;
+    std::mutex              write_mutex_; /* keeps writes in pending_ order */
+    std::string             rxbuf_;
+    std::string             machine_out_; /* output before '#<seq> <rc>' */
+    std::string             error_;
+};
+
+} // namespace brink
+
+#endif/*__BRINK_CLIENT_H_INCLUDED__*/
@@ -0,0 +1,76 @@
+/*
+ * brinkctl - send shell commands to a brink device.
+ *
+ *   brinkctl [-b baud] [-r rate | -R rate] [-w boot_wait_ms] /dev/ttyACM0 'rgb 255 0 0' ...
+ *
+ * -r switches the device to another baud rate before the commands, for
+ * this session only; -R keeps it across reboots (connect with -b next).
+ * Commands are given as arguments, or one per line from stdin if none.
+ * They are pipelined, and the output of each is printed in order.
+ * Exits with 1 if any command failed.
+ */
+#include "brink_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv)
+{
+    brink::options opts;
+    int  rate = 0;
+    bool save = false;
+    int opt;
+
+    opts.machine_mode = true;
+    while ( (opt = getopt(argc, argv, "b:r:R:w:")) != -1 ) {
+        switch ( opt ) {
+            case 'b': opts.baud = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); save = false; break;
+            case 'R': rate = atoi(optarg); save = true; break;
+            case 'w': opts.boot_wait_ms = atoi(optarg); break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if ( optind >= argc ) {
+        fprintf(stderr, "Usage: %s [-b baud] [-r rate | -R rate] [-w boot_wait_ms] tty [command...]\n", argv[0]);
+        return 2;
+    }
+
+    int failed = 0;
+    try {
+        brink::client dev(argv[optind], opts);
+        if ( rate ) {
+            dev.set_baud(rate, save);
+        }
+        brink::client::callback print = [&failed](const brink::reply& r) {
+            fputs(r.output.c_str(), stdout);
+            if ( r.rc != 0 ) {
+                failed = 1;
+            }
+        };
+
+        if ( optind + 1 < argc ) {
+            for ( int i = optind + 1;  i < argc;  i++ ) {
+                dev.submit(argv[i], print);
+            }
+        } else {
+            std::string line;
+            while ( std::getline(std::cin, line) ) {
+                if ( line.find_first_not_of(" \t") != std::string::npos ) {
+                    dev.submit(line, print);
+                }
+            }
+        }
+        dev.drain();
+    } catch ( const std::exception& e ) {
+        fprintf(stderr, "brinkctl: %s\n", e.what());
+        return 1;
+    }
+    return failed;
+}
@@ -0,0 +1,233 @@
+#include "fake_device.h"
+#include "brink_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <sstream>
+#include <vector>
+
+namespace brink {
+
+static const char PROMPT[] = "LED> ";
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+fake_device::fake_device(const fake_options& opts)
+    : opts_(opts)
+{
+    struct termios tio;
+
+    master_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if ( master_ < 0 || grantpt(master_) < 0 || unlockpt(master_) < 0 ) {
+        throw error(std::string("pty: ") + strerror(errno));
+    }
+    tty_ = ptsname(master_);
+
+    /*
+     * Keep the slave open and raw, so the line discipline neither echoes
+     * nor cooks anything between the client's open() calls.
+     */
+    slave_ = ::open(tty_.c_str(), O_RDWR | O_NOCTTY);
+    if ( slave_ < 0 || tcgetattr(slave_, &tio) < 0 ) {
+        throw error(tty_ + ": " + strerror(errno));
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave_, TCSANOW, &tio);
+    fcntl(master_, F_SETFL, fcntl(master_, F_GETFL) | O_NONBLOCK);
+
+    put("\r\n\r\n*** fake brink ***\r\n");
+    put(PROMPT);
+    thread_ = std::thread(&fake_device::run, this);
+}
+
+
+fake_device::~fake_device()
+{
+    stop_ = true;
+    thread_.join();
+    ::close(slave_);
+    ::close(master_);
+}
+
+
+void fake_device::put(const std::string& s)
+{
+    tx_ += s;
+}
+
+
+/*
+ * Time-stepped model of the wire and the sketch's loop():
+ *   host -> wire_in -> (baud) -> rx_ (drops if full) -> handle()
+ *   handle() -> tx_ (stalls if full) -> (baud) -> air -> (latency) -> host
+ */
+void fake_device::run()
+{
+    const long long byte_us = 10 * 1000000LL / opts_.baud;
+    std::string wire_in;
+    std::deque<std::pair<long long, char> > air;
+    long long rx_at = now_us();
+    long long tx_at = now_us();
+
+    while ( ! stop_ ) {
+        long long now = now_us();
+
+        /* host -> device */
+        char buf[256];
+        ssize_t n;
+        while ( (n = read(master_, buf, sizeof(buf))) > 0 ) {
+            wire_in.append(buf, n);
+        }
+        while ( ! wire_in.empty() && now >= rx_at + byte_us ) {
+            rx_at += byte_us;
+            if ( (int)rx_.size() < opts_.rx_buffer ) {
+                rx_ += wire_in[0];
+            } else {
+                dropped_++;
+            }
+            wire_in.erase(0, 1);
+        }
+        if ( wire_in.empty() ) {
+            rx_at = now; /* idle; the next byte starts now */
+        }
+
+        /*
+         * loop(); a command blocks it for exec_us, and so does a full TX
+         * buffer, while the RX buffer keeps filling up.
+         */
+        while ( ! rx_.empty() && (int)tx_.size() < 64 ) {
+            char c = rx_[0];
+            rx_.erase(0, 1);
+            handle(c);
+        }
+
+        /* device -> host */
+        while ( ! tx_.empty() && now >= tx_at + byte_us ) {
+            tx_at += byte_us;
+            air.push_back(std::make_pair(tx_at + opts_.latency_us, tx_[0]));
+            tx_.erase(0, 1);
+        }
+        if ( tx_.empty() ) {
+            tx_at = now;
+        }
+        std::string out;
+        while ( ! air.empty() && air.front().first <= now ) {
+            out += air.front().second;
+            air.pop_front();
+        }
+        if ( ! out.empty() && write(master_, out.data(), out.size()) < 0 ) {
+            break;
+        }
+
+        usleep(50);
+    }
+}
+
+
+void fake_device::handle(char c)
+{
+    switch ( c ) {
+        case '\x03':
+            linebuf_.clear();
+            if ( ! machine_ ) {
+                put("\r\n");
+                put(PROMPT);
+            }
+            break;
+
+        case '\r':
+        case '\n':
+            if ( ! machine_ ) {
+                put("\r\n");
+            }
+            line(linebuf_);
+            linebuf_.clear();
+            break;
+
+        case '\b':
+        case 0x7f:
+            if ( ! linebuf_.empty() ) {
+                linebuf_.erase(linebuf_.size() - 1);
+                if ( ! machine_ ) {
+                    put("\b \b");
+                }
+            }
+            break;
+
+        default:
+            if ( c >= ' ' && c < 0x7f ) {
+                linebuf_ += c;
+                if ( ! machine_ ) {
+                    put(std::string(1, c));
+                }
+            }
+            break;
+    }
+}
+
+
+void fake_device::line(const std::string& cmd)
+{
+    std::istringstream in(cmd);
+    std::vector<std::string> argv;
+    std::string arg;
+    while ( in >> arg ) {
+        argv.push_back(arg);
+    }
+
+    bool reply = machine_;
+    if ( argv.empty() ) {
+        if ( ! machine_ ) {
+            put(PROMPT);
+        }
+        return;
+    }
+    commands_++;
+    usleep(opts_.exec_us);
+
+    int rc = 0;
+    if ( ! machine_ ) {
+        put("\r\n");
+    }
+    if ( argv[0] == "echo" ) {
+        for ( size_t i = 1;  i < argv.size();  i++ ) {
+            put(argv[i] + " ");
+        }
+        put("\r\n");
+    } else if ( argv[0] == "rgb" ) {
+        rc = ( argv.size() == 2 || argv.size() == 4 ) ? 0 : 1;
+    } else if ( argv[0] == "mode" && argv.size() == 2 && argv[1] == "machine" ) {
+        machine_ = true;
+        seq_     = 0;
+    } else if ( argv[0] == "mode" && argv.size() == 2 && argv[1] == "human" ) {
+        machine_ = false;
+    } else {
+        rc = -1;
+        if ( ! machine_ ) {
+            put("command not found: '" + argv[0] + "'\r\n");
+        }
+    }
+
+    if ( reply || machine_ ) {
+        put("#" + std::to_string(seq_++) + " " + std::to_string(rc) + "\r\n");
+    }
+    if ( ! machine_ ) {
+        put(PROMPT);
+    }
+}
+
+} // namespace brink
@@ -0,0 +1,61 @@
+#ifndef __BRINK_FAKE_DEVICE_H_INCLUDED__
+#define __BRINK_FAKE_DEVICE_H_INCLUDED__
+
+/*
+ * A stand-in for the device on a pseudo-terminal, to test and benchmark
+ * libbrink without hardware.
+ *
+ * It speaks the text protocol of shell.ino (echo back, prompt, 'mode
+ * machine' replies), and paces both directions at the baud rate with a
+ * 64-byte RX buffer like the Arduino core's, so bytes sent too far ahead
+ * are dropped and counted, as on the real thing.
+ */
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace brink {
+
+struct fake_options {
+    int baud       = 9600;
+    int latency_us = 1000; /* USB-serial delivery delay to the host */
+    int exec_us    = 200;  /* time spent executing a command */
+    int rx_buffer  = 64;
+};
+
+class fake_device {
+public:
+    explicit fake_device(const fake_options& opts = fake_options());
+    ~fake_device();
+
+    /* Path of the pty for the client to open */
+    const std::string& tty() const { return tty_; }
+
+    unsigned long commands() const { return commands_; }
+    unsigned long dropped() const { return dropped_; }
+
+private:
+    void run();
+    void handle(char c);
+    void line(const std::string& cmd);
+    void put(const std::string& s);
+
+    fake_options              opts_;
+    int                       master_ = -1;
+    int                       slave_  = -1;
+    std::string               tty_;
+    std::thread               thread_;
+    std::atomic<bool>         stop_{false};
+    std::atomic<unsigned long> commands_{0};
+    std::atomic<unsigned long> dropped_{0};
+
+    std::string               rx_;   /* RX buffer of the device */
+    std::string               tx_;   /* not sent on the wire yet */
+    std::string               linebuf_;
+    bool                      machine_ = false;
+    unsigned                  seq_     = 0;
+};
+
+} // namespace brink
+
+#endif/*__BRINK_FAKE_DEVICE_H_INCLUDED__*/
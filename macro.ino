@@ -0,0 +1,360 @@
+/*
+ * Macros: named lists of commands, defined by 'def <name> { ... }'.
+ *
+ * A macro is compiled once, when it's defined: each command is looked up
+ * in the registry and split into its arguments, and the arguments of a
+ * typed command are converted by its schema, so running it takes no
+ * parsing, conversion nor name lookups. Macros are packed one after
+ * another in pool[]:
+ *
+ *     name '\0'  len  code[len]
+ *
+ * where code[] is a sequence of commands, each
+ *
+ *     index  argc  argv[1] '\0' ... argv[argc - 1] '\0'
+ *
+ * with 'index' of the command in the registry (msh_command_index()), or
+ * for a typed command
+ *
+ *     index  0  len  args[len]
+ *
+ * with the arguments packed by msh_pack_args().
+ *
+ * macro_save() copies the pool to EEPROM, with a hash of the names and
+ * the schemas of all the commands, so that the indices and the packed
+ * arguments are not used by a firmware with another set of commands.
+ */
+#include <stdint.h>
+#include <EEPROM.h>
+#include "picoshell.h"
+#include "brink.h"
+
+#ifndef MACRO_POOL_BYTES
+#define MACRO_POOL_BYTES  128
+#endif
+#if MACRO_POOL_BYTES > 255
+#error "offsets in the pool are 8-bit"
+#endif
+
+#define MACRO_CHECK_SEED  0x3C
+
+typedef struct {
+    uint16_t commands;  /* macro_commands_hash() */
+    uint8_t  used;
+    uint8_t  check;     /* MACRO_CHECK_SEED + the bytes above and the pool, 8-bit */
+} macro_header_t;
+
+static struct {
+    uint8_t used;
+    uint8_t pool[MACRO_POOL_BYTES];
+} macro;
+
+
+/* FNV-1a over the string 's' in flash, with its '\0' */
+static uint16_t macro_hash_P(uint16_t h, const char* s)
+{
+    char c;
+
+    do {
+        c = pgm_read_byte(s++);
+        h = (h ^ (uint8_t)c) * 0x0103;
+    } while ( c != '\0' );
+    return h;
+}
+
+/* FNV-1a over the names and the schemas of the commands in the registry */
+static uint16_t macro_commands_hash(void)
+{
+    uint16_t h = 0x811C;
+    const char* name;
+
+    for ( int i = 0;  (name = msh_command_name(i)) != NULL;  i++ ) {
+        const char* schema = msh_command_schema(i);
+        h = macro_hash_P(h, name);
+        if ( schema != NULL ) {
+            h = macro_hash_P(h, schema);
+        }
+    }
+    return h;
+}
+
+static uint8_t macro_checksum(const macro_header_t* h)
+{
+    const uint8_t* p = (const uint8_t*)h;
+    uint8_t sum = MACRO_CHECK_SEED;
+
+    for ( uint8_t i = 0;  i < offsetof(macro_header_t, check);  i++ ) {
+        sum += p[i];
+    }
+    for ( uint8_t i = 0;  i < h->used;  i++ ) {
+        sum += macro.pool[i];
+    }
+    return sum;
+}
+
+/* the size of the macro at 'p', in pool[] */
+static uint8_t macro_size(const uint8_t* p)
+{
+    uint8_t name = strlen((const char*)p) + 1;
+    return name + 1 + p[name];
+}
+
+static uint8_t* macro_find(const char* name)
+{
+    uint8_t* p = macro.pool;
+
+    while ( p < macro.pool + macro.used ) {
+        if ( strcmp((const char*)p, name) == 0 ) {
+            return p;
+        }
+        p += macro_size(p);
+    }
+    return NULL;
+}
+
+static void macro_remove(uint8_t* p)
+{
+    uint8_t size = macro_size(p);
+
+    memmove(p, p + size, macro.pool + macro.used - (p + size));
+    macro.used -= size;
+}
+
+/*
+ * Compile "{ cmd args; ... }" into code[] up to 'end'. Returns the end
+ * of the code, or NULL setting *err.
+ */
+static uint8_t* macro_compile(const char* body, uint8_t* code, const uint8_t* end, int* err)
+{
+    char  buf[MSH_CMDLINE_CHAR_MAX];
+    char* line = buf;
+    char* argv[MSH_CMDARGS_MAX];
+    int   argc;
+    size_t len = strlen(body);
+
+    if ( len < 2 || body[0] != '{' || body[len - 1] != '}' || len - 1 > sizeof(buf) ) {
+        *err = MACRO_ERR_SYNTAX;
+        return NULL;
+    }
+    memcpy(buf, body + 1, len - 2);
+    buf[len - 2] = '\0';
+
+    while ( 1 ) {
+        char* next = msh_parse_line_inplace(line, &argc, argv);
+        if ( next == NULL ) {
+            *err = MACRO_ERR_SYNTAX;
+            return NULL;
+        }
+        if ( argc > 0 ) {
+            int index = msh_command_index(argv[0]);
+            if ( index < 0 || strcmp(argv[0], "def") == 0 || strcmp(argv[0], "baud") == 0 ) {
+                *err = MACRO_ERR_COMMAND;
+                return NULL;
+            }
+            if ( code + 3 > end ) {
+                *err = MACRO_ERR_FULL;
+                return NULL;
+            }
+            int packed = msh_pack_args(index, argc, (const char**)argv, code + 3, end - (code + 3));
+            if ( packed < 0 ) {
+                *err = ( packed == -1 ) ? MACRO_ERR_ARGS : MACRO_ERR_FULL;
+                return NULL;
+            }
+            *code++ = index;
+            if ( packed > 0 ) {
+                *code++ = 0;
+                *code++ = packed;
+                code += packed;
+            } else {
+                *code++ = argc;
+                for ( int i = 1;  i < argc;  i++ ) {
+                    size_t n = strlen(argv[i]) + 1;
+                    if ( code + n > end ) {
+                        *err = MACRO_ERR_FULL;
+                        return NULL;
+                    }
+                    memcpy(code, argv[i], n);
+                    code += n;
+                }
+            }
+        }
+        if ( next == line ) {
+            return code;
+        }
+        line = next;
+    }
+}
+
+/*
+ * Define macro 'name' as 'body', "{ cmd args; ... }", or add 'body' to
+ * the end of it if 'append'. Returns MACRO_OK, or an error, changing
+ * nothing. A macro can't call 'def' nor other macros, nor 'baud', which
+ * needs the reply to reach the host before switching.
+ */
+int macro_define(const char* name, const char* body, bool append)
+{
+    uint8_t  namelen = strlen(name) + 1;
+    uint8_t* old     = macro_find(name);
+    uint8_t* p       = macro.pool + macro.used;
+    uint8_t* end     = macro.pool + MACRO_POOL_BYTES;
+    int      err     = MACRO_ERR_FULL;
+
+    if ( name[0] == '*' || name[0] == '{' || msh_command_index(name) >= 0 ) {
+        return MACRO_ERR_NAME;
+    }
+    /* built after the pool, and moved down over the old one at last */
+    if ( p + namelen + 1 > end ) {
+        return MACRO_ERR_FULL;
+    }
+    memcpy(p, name, namelen);
+    uint8_t* code = p + namelen + 1;
+    uint8_t* q    = code;
+    if ( append && old ) {
+        uint8_t oldlen = old[namelen];
+        if ( q + oldlen > end ) {
+            return MACRO_ERR_FULL;
+        }
+        memcpy(q, old + namelen + 1, oldlen);
+        q += oldlen;
+    }
+    q = macro_compile(body, q, end, &err);
+    if ( q == NULL ) {
+        return err;
+    }
+    if ( q - code > 255 ) {
+        return MACRO_ERR_FULL;
+    }
+    code[-1] = q - code;
+    macro.used += q - p;
+    if ( old ) {
+        macro_remove(old);
+    }
+    return MACRO_OK;
+}
+
+/*
+ * Delete macro 'name', or all of them if 'name' is "*".
+ */
+bool macro_delete(const char* name)
+{
+    if ( strcmp(name, "*") == 0 ) {
+        macro.used = 0;
+        return true;
+    }
+    uint8_t* p = macro_find(name);
+    if ( p == NULL ) {
+        return false;
+    }
+    macro_remove(p);
+    return true;
+}
+
+/*
+ * Run macro 'name'. Returns -1 if no such macro, or the return code of
+ * the first command which failed, or 0. The rest run even if one fails,
+ * as commands separated by ';' do.
+ */
+int macro_run(const char* name)
+{
+    const uint8_t* p = macro_find(name);
+    char  cmdname[MSH_CMDLINE_CHAR_MAX];
+    const char* argv[MSH_CMDARGS_MAX];
+    int   ret = 0;
+
+    if ( p == NULL ) {
+        return -1;
+    }
+    p += strlen(name) + 1;
+    const uint8_t* end = p + 1 + *p;
+    p++;
+    while ( p < end ) {
+        uint8_t index = *p++;
+        uint8_t argc  = *p++;
+        int     rc;
+
+        if ( argc == 0 ) {
+            uint8_t len = *p++;
+            rc = msh_exec_packed(index, p);
+            p += len;
+            if ( rc != 0 && ret == 0 ) {
+                ret = rc;
+            }
+            continue;
+        }
+        strncpy_P(cmdname, msh_command_name(index), sizeof(cmdname) - 1);
+        cmdname[sizeof(cmdname) - 1] = '\0';
+        argv[0] = cmdname;
+        for ( uint8_t i = 1;  i < argc;  i++ ) {
+            argv[i] = (const char*)p;
+            p += strlen((const char*)p) + 1;
+        }
+        rc = msh_exec_index(index, argc, argv);
+        if ( rc != 0 && ret == 0 ) {
+            ret = rc;
+        }
+    }
+    return ret;
+}
+
+/*
+ * The macros from the first (i = 0), for listing: returns the name of the
+ * i-th macro and sets its code, or returns NULL past the last.
+ */
+const char* macro_get(uint8_t i, const uint8_t** code, uint8_t* len)
+{
+    uint8_t* p = macro.pool;
+
+    while ( p < macro.pool + macro.used ) {
+        if ( i-- == 0 ) {
+            uint8_t namelen = strlen((const char*)p) + 1;
+            *len  = p[namelen];
+            *code = p + namelen + 1;
+            return (const char*)p;
+        }
+        p += macro_size(p);
+    }
+    return NULL;
+}
+
+uint8_t macro_pool_used(void)
+{
+    return macro.used;
+}
+
+/*
+ * Save all the macros to EEPROM, to be restored at boot.
+ */
+void macro_save(void)
+{
+    macro_header_t h;
+
+    h.commands = macro_commands_hash();
+    h.used     = macro.used;
+    h.check    = macro_checksum(&h);
+    EEPROM.put(EEPROM_MACRO_ADDR, h);
+    for ( uint8_t i = 0;  i < macro.used;  i++ ) {
+        EEPROM.update(EEPROM_MACRO_ADDR + sizeof(h) + i, macro.pool[i]);
+    }
+}
+
+/*
+ * Restore the macros saved, once all the commands are registered.
+ * Returns false if none, or they were saved by another firmware.
+ */
+bool macro_restore(void)
+{
+    macro_header_t h;
+
+    EEPROM.get(EEPROM_MACRO_ADDR, h);
+    if ( h.used > MACRO_POOL_BYTES || h.commands != macro_commands_hash() ) {
+        return false;
+    }
+    for ( uint8_t i = 0;  i < h.used;  i++ ) {
+        macro.pool[i] = EEPROM.read(EEPROM_MACRO_ADDR + sizeof(h) + i);
+    }
+    if ( h.check != macro_checksum(&h) ) {
+        return false;
+    }
+    macro.used = h.used;
+    return true;
+}
@@ -0,0 +1,78 @@
+/*
+ * SRAM usage, measured on the device.
+ *
+ * Before main() runs, mem_paint() fills the RAM between the end of the
+ * static data (.data and .bss) and the stack with MEM_CANARY. The stack
+ * grows down over it, and the heap (if malloc() is ever used) up, so the
+ * lowest byte not holding the canary any more marks the deepest the
+ * stack has been since boot:
+ *
+ *   RAMSTART  .data .bss | heap ->   canary ...   <- stack | RAMEND
+ *                      __heap_start           low water    SP
+ *
+ * A stack byte that happens to be written with MEM_CANARY itself makes
+ * the high-water mark look lower by that much, rarely more than a byte.
+ */
+#include <stdint.h>
+#include "brink.h"
+
+#define MEM_CANARY  0xC5
+
+#ifdef __AVR__
+extern uint8_t __data_start;
+extern uint8_t __heap_start;
+extern char*   __brkval;  /* the end of the heap, or NULL if never used */
+
+#define MEM_STR(x)   MEM_STR_(x)
+#define MEM_STR_(x)  #x
+
+/*
+ * In .init3, right after the stack pointer is set up in .init2, and
+ * before anything else is put on the stack. 'naked' so that it has no
+ * frame of its own; code in .initN falls through to the next section.
+ * In asm, as a naked function may hold nothing but basic asm: compiled
+ * C could use the stack or registers not set up yet. Paints from
+ * __heap_start up to SP, inclusive.
+ */
+void mem_paint(void) __attribute__((naked, used, section(".init3")));
+void mem_paint(void)
+{
+    asm volatile(
+        "    ldi  r30, lo8(__heap_start)  \n\t"
+        "    ldi  r31, hi8(__heap_start)  \n\t"
+        "    in   r26, __SP_L__           \n\t"
+        "    in   r27, __SP_H__           \n\t"
+        "    ldi  r24, " MEM_STR(MEM_CANARY) "\n\t"
+        "1:  st   Z+, r24                 \n\t"
+        "    cp   r26, r30                \n\t"  /* while SP >= Z */
+        "    cpc  r27, r31                \n\t"
+        "    brsh 1b                      \n\t");
+}
+
+static uint8_t* mem_heap_end(void)
+{
+    return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+
+bool mem_get(mem_info_t* info)
+{
+    uint8_t* low = mem_heap_end();
+
+    while ( low <= (uint8_t*)SP && *low == MEM_CANARY ) {
+        low++;
+    }
+    info->ram        = RAMEND + 1 - (uint16_t)&__data_start;
+    info->static_ram = (uint16_t)&__heap_start - (uint16_t)&__data_start;
+    info->heap_used  = mem_heap_end() - &__heap_start;
+    info->stack_now  = RAMEND - SP;
+    info->stack_max  = RAMEND + 1 - (uint16_t)low;
+    info->never_used = low - mem_heap_end();
+    return true;
+}
+#else
+/* the host has no fixed memory map to watch */
+bool mem_get(mem_info_t* info)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Persisting the LED state in EEPROM.
+ *
+ * Every save appends a small record to a log of PERSIST_SLOTS slots
+ * used in turn, so that each EEPROM cell is written only once per
+ * PERSIST_SLOTS saves. The latest record is the valid one with the
+ * newest sequence number.
+ */
+#include <stddef.h>
+#include <EEPROM.h>
+#include "brink.h"
+
+#define PERSIST_SLOTS        64
+#define PERSIST_CHECK_SEED   0xA5
+#define PERSIST_AUTOSAVE_MS  2000  /* save once the state is stable this long */
+#define PERSIST_TICK_MS      100
+
+#define PERSIST_FLAG_AUTOSAVE  0x01
+
+static struct {
+    int8_t  slot;            /* slot of the latest record, or -1 */
+    uint8_t flags;           /* PERSIST_FLAG_* */
+    persist_record_t saved;  /* the latest record */
+    persist_record_t pending;
+    unsigned long changed_ms;
+    unsigned long tick_ms;
+} persist = { -1 };
+
+
+static uint8_t persist_checksum(const persist_record_t* rec)
+{
+    const uint8_t* p = (const uint8_t*)rec;
+    uint8_t sum = PERSIST_CHECK_SEED;
+    for ( uint8_t i = 0;  i < offsetof(persist_record_t, check);  i++ ) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+static int persist_addr(int8_t slot)
+{
+    return EEPROM_PERSIST_ADDR + slot * sizeof(persist_record_t);
+}
+
+/* the state to be saved, except for seq and check */
+static void persist_current(persist_record_t* rec)
+{
+    rec->pattern    = anim_get_state(rec->rgb);
+    rec->brightness = led_get_brightness();
+    rec->flags      = persist.flags;
+}
+
+static bool persist_same(const persist_record_t* a, const persist_record_t* b)
+{
+    return memcmp(&a->rgb, &b->rgb, offsetof(persist_record_t, check)
+                                    - offsetof(persist_record_t, rgb)) == 0;
+}
+
+
+/*
+ * Find the latest record, and restore the state from it.
+ * Returns false if there's nothing saved.
+ */
+bool persist_restore(void)
+{
+    persist_record_t rec;
+
+    persist.slot = -1;
+    for ( int8_t i = 0;  i < PERSIST_SLOTS;  i++ ) {
+        EEPROM.get(persist_addr(i), rec);
+        if ( rec.check != persist_checksum(&rec) ) {
+            continue;
+        }
+        /* sequence numbers wrap around, but stay within PERSIST_SLOTS */
+        if ( persist.slot < 0 || (int8_t)(rec.seq - persist.saved.seq) > 0 ) {
+            persist.slot  = i;
+            persist.saved = rec;
+        }
+    }
+    if ( persist.slot < 0 ) {
+        return false;
+    }
+
+    persist.pending = persist.saved;
+    persist.flags   = persist.saved.flags;
+    led_set_brightness(persist.saved.brightness);
+    anim_set(persist.saved.rgb[0], persist.saved.rgb[1], persist.saved.rgb[2]);
+    if ( persist.saved.pattern ) {
+        anim_pattern_start(persist.saved.pattern);
+    }
+    return true;
+}
+
+
+/*
+ * Save the current state, unless it is already the latest record.
+ */
+void persist_save(void)
+{
+    persist_record_t rec;
+
+    persist_current(&rec);
+    if ( persist.slot >= 0 && persist_same(&rec, &persist.saved) ) {
+        return;
+    }
+    persist.slot  = ( persist.slot + 1 ) % PERSIST_SLOTS;
+    rec.seq       = persist.saved.seq + 1;
+    rec.check     = persist_checksum(&rec);
+    EEPROM.put(persist_addr(persist.slot), rec);
+    persist.saved = rec;
+}
+
+
+void persist_set_autosave(bool enable)
+{
+    if ( enable ) {
+        persist.flags |= PERSIST_FLAG_AUTOSAVE;
+    } else {
+        persist.flags &= ~PERSIST_FLAG_AUTOSAVE;
+    }
+    persist_save();
+}
+
+bool persist_get_autosave(void)
+{
+    return ( persist.flags & PERSIST_FLAG_AUTOSAVE );
+}
+
+
+/*
+ * Called from loop(). With autosave, saves the state once it has not
+ * changed for PERSIST_AUTOSAVE_MS, so a running fade or a burst of
+ * commands costs one write.
+ */
+void persist_tick(void)
+{
+    unsigned long now = millis();
+    persist_record_t rec;
+
+    if ( ! persist_get_autosave() || now - persist.tick_ms < PERSIST_TICK_MS ) {
+        return;
+    }
+    persist.tick_ms = now;
+
+    persist_current(&rec);
+    if ( ! persist_same(&rec, &persist.pending) ) {
+        persist.pending    = rec;
+        persist.changed_ms = now;
+    }
+    else
+    if ( ! persist_same(&rec, &persist.saved)
+         && now - persist.changed_ms >= PERSIST_AUTOSAVE_MS ) {
+        persist_save();
+    }
+}
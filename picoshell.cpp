@@ -3,9 +3,57 @@
 
 #include "picoshell.h"
 #include "picoshell_config.h"
+#include "picoshell_pgmspace.h"
 #include "picoshell_termesc.h"
 
 
+/*
+ * Accessors of msh_command_entry, which is in flash
+ */
+typedef int (*msh_command_func)(int argc, const char** argv);
+
+static inline const char* entry_name(const msh_command_entry* e)
+{
+    return (const char*)pgm_read_ptr(&e->name);
+}
+
+static inline msh_command_func entry_func(const msh_command_entry* e)
+{
+    return (msh_command_func)pgm_read_ptr(&e->func);
+}
+
+typedef int (*msh_typed_func)(const msh_args* args);
+
+static inline msh_typed_func entry_typed(const msh_command_entry* e)
+{
+    return (msh_typed_func)pgm_read_ptr(&e->typed);
+}
+
+static inline const char* entry_schema(const msh_command_entry* e)
+{
+    return (const char*)pgm_read_ptr(&e->schema);
+}
+
+
+void msh_puts_P(const char* s)
+{
+    char buf[16];
+    int  len = 0;
+    char c;
+
+    while ( (c = pgm_read_byte(s++)) != '\0' ) {
+        buf[len++] = c;
+        if ( len == sizeof(buf) ) {
+            pico_write(buf, len);
+            len = 0;
+        }
+    }
+    if ( len > 0 ) {
+        pico_write(buf, len);
+    }
+}
+
+
 /* ***************************************************************************
  *                cmdedit help strings (displayed by 'shellhelp')
  * ***************************************************************************/
@@ -13,10 +61,10 @@
 #ifdef MSH_CONFIG_LINEEDIT
 #    define MSH_HELP_LINEEDIT \
         " * Minimal Emacs-like line editting. (Ctrl+F,B,E,A)\n" \
-        "    Ctrl-F  Cursor right     ('F'orward)\n"  \
-        "    Ctrl-B  Cursor left      ('B'ackward)\n" \
-        "    Ctrl-A  Cursor line head ('A'head)\n"  \
-        "    Ctrl-E  Cursor line tail ('E'nd)\n"
+        "    Ctrl-F  Cursor right     ('F'orward), or Right\n"  \
+        "    Ctrl-B  Cursor left      ('B'ackward), or Left\n" \
+        "    Ctrl-A  Cursor line head ('A'head), or Home\n"  \
+        "    Ctrl-E  Cursor line tail ('E'nd), or End\n"
 #else
 #   define MSH_HELP_LINEEDIT ""
 #endif
@@ -24,8 +72,8 @@
 #ifdef MSH_CONFIG_CMDHISTORY
 #    define MSH_HELP_CMDHISTORY \
         " * Command-line history. (Ctrl+P,N)\n" \
-        "    Ctrl-P  Previous history ('P'revious)\n" \
-        "    Ctrl-N  Next history     ('N'ext)\n"
+        "    Ctrl-P  Previous history ('P'revious), or Up\n" \
+        "    Ctrl-N  Next history     ('N'ext), or Down\n"
 #else
 #   define MSH_HELP_CMDHISTORY ""
 #   define MSH_HELP_CMDHISTORY_KEYS ""
@@ -44,7 +92,7 @@
 #define MSH_CMDEDIT_HELP_DESCRIPTION \
     "* Basic keybinds\n" \
     "    Ctrl-H  Backspace\n" \
-    "    Ctrl-D  Delete\n" \
+    "    Ctrl-D  Delete, or Delete\n" \
     "    Ctrl-L  Clear screen\n" \
     "    Ctrl-C  Discard line\n" \
     "    Ctrl-U  Kill whole line\n" \
@@ -60,7 +108,7 @@
 #ifdef MSH_CONFIG_HELP_KEYBIND
 static int cmd_shellhelp(int argc, const char** argv)
 {
-    pico_puts(MSH_CMDEDIT_HELP_DESCRIPTION);
+    msh_puts_P(PSTR(MSH_CMDEDIT_HELP_DESCRIPTION));
     return 0;
 }
 #endif
@@ -81,24 +129,101 @@ static int cmd_echo(int argc, const char** argv)
 }
 
 
+static int cmd_term(int argc, const char** argv)
+{
+    if ( argc == 2 && strcmp(argv[1], "vt100") == 0 ) {
+        msh_set_vt100(1);
+    }
+    else
+    if ( argc == 2 && strcmp(argv[1], "dumb") == 0 ) {
+        msh_set_vt100(0);
+    }
+    else
+    if ( argc != 1 ) {
+        return 1;
+    }
+    pico_puts( msh_get_vt100() ? "vt100\n" : "dumb\n" );
+    return 0;
+}
+
+
 /* ***************************************************************************
  *                          command registration
  * ***************************************************************************/
 
-const msh_command_entry msh_builtin_commands[] = {
+/*
+ * The builtins are static, so msh_declare_command() can't be used;
+ * their strings are defined one by one here, in flash as well.
+ */
 #ifdef MSH_CONFIG_HELP_KEYBIND
-    { "shellhelp", cmd_shellhelp,
-        "display help for keybinds of commandline editting",
-        "No further help available.\n",
+static const char builtin_shellhelp_name[] PROGMEM = "shellhelp";
+#ifdef MSH_CONFIG_HELP
+static const char builtin_shellhelp_desc[] PROGMEM =
+        "display help for keybinds of commandline editting";
+static const char builtin_shellhelp_usage[] PROGMEM =
+        "No further help available.\n";
+#endif
+#endif
+
+static const char builtin_echo_name[] PROGMEM = "echo";
+static const char builtin_term_name[] PROGMEM = "term";
+#ifdef MSH_CONFIG_STATS
+static const char builtin_stats_name[] PROGMEM = "stats";
+static int cmd_stats(int argc, const char** argv); /* with the registry */
+#endif
+
+#ifdef MSH_CONFIG_HELP
+static const char builtin_echo_desc[] PROGMEM =
+        "echo all arguments separated by a whitespace";
+static const char builtin_echo_usage[] PROGMEM =
+        "Usage: echo [string ...]\n";
+
+static const char builtin_term_desc[] PROGMEM =
+        "show or set the terminal type for line editting";
+static const char builtin_term_usage[] PROGMEM =
+        "Usage: term [vt100|dumb]\n"
+        "    vt100 redraws the line with cursor control sequences,\n"
+        "    dumb  redraws it by reprinting chars and backspaces.\n";
+
+#ifdef MSH_CONFIG_STATS
+static const char builtin_stats_desc[] PROGMEM =
+        "show or reset the performance counters";
+static const char builtin_stats_usage[] PROGMEM =
+        "Usage: stats [reset]\n"
+        "    Shows the serial I/O, lines and time spent parsing and in\n"
+        "    commands, and the calls and longest run of each command,\n"
+        "    since boot or the last reset.\n";
+#endif
+#endif
+
+const msh_command_entry msh_builtin_commands[] PROGMEM = {
+#ifdef MSH_CONFIG_HELP_KEYBIND
+    { builtin_shellhelp_name, cmd_shellhelp,
+#ifdef MSH_CONFIG_HELP
+        builtin_shellhelp_desc, builtin_shellhelp_usage
+#endif
+    },
+#endif
+
+    { builtin_echo_name, cmd_echo,
+#ifdef MSH_CONFIG_HELP
+        builtin_echo_desc, builtin_echo_usage
+#endif
     },
+
+    { builtin_term_name, cmd_term,
+#ifdef MSH_CONFIG_HELP
+        builtin_term_desc, builtin_term_usage
 #endif
+    },
 
-    { "echo", cmd_echo,
+#ifdef MSH_CONFIG_STATS
+    { builtin_stats_name, cmd_stats,
 #ifdef MSH_CONFIG_HELP
-        "echo all arguments separated by a whitespace",
-        "Usage: echo [string ...]\n"
+        builtin_stats_desc, builtin_stats_usage
 #endif
     },
+#endif
 
     MSH_COMMAND_TERMINATOR
 };
@@ -111,8 +236,8 @@ static const msh_command_entry *
 find_command_entry(const msh_command_entry* cmdlist, const char* name)
 {
     int i = 0;
-    while ( cmdlist[i].name != NULL ) {
-        if ( strcmp(cmdlist[i].name, name) == 0 ) {
+    while ( entry_name(&cmdlist[i]) != NULL ) {
+        if ( strcmp_P(name, entry_name(&cmdlist[i])) == 0 ) {
             return &cmdlist[i];
         } else {
             i++;
@@ -122,76 +247,805 @@ find_command_entry(const msh_command_entry* cmdlist, const char* name)
 }
 
 
+/* ***************************************************************************
+ *                          the command registry
+ * ***************************************************************************/
+/*
+ * All command tables are merged into one array of entries sorted by name,
+ * so that a command is looked up by a single binary search no matter how
+ * many tables it is defined in.
+ */
+static const msh_command_entry* registry[MSH_COMMANDS_MAX];
+static int registry_count;
+
+#ifdef MSH_CONFIG_STATS
+msh_stats_t msh_stats;
+
+/* per command, in the order of registry[] */
+static struct {
+    unsigned int  calls;
+    unsigned long max_us;
+} command_stats[MSH_COMMANDS_MAX];
+#endif
+
+/*
+ * Binary search for 'name'. Returns its index if found, or -(insertion
+ * point)-1 if not.
+ */
+static int
+registry_search(const char* name)
+{
+    int lo = 0;
+    int hi = registry_count - 1;
+
+    while ( lo <= hi ) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp_P(name, entry_name(registry[mid]));
+        if ( cmp > 0 ) {
+            lo = mid + 1;
+        } else if ( cmp < 0 ) {
+            hi = mid - 1;
+        } else {
+            return mid;
+        }
+    }
+    return -lo - 1;
+}
+
+
+int msh_register_commands(const msh_command_entry* cmdlist)
+{
+    char name[MSH_CMDLINE_CHAR_MAX];
+    const char* pname;
+    int i;
+
+    for ( i = 0;  (pname = entry_name(&cmdlist[i])) != NULL;  i++ ) {
+        strncpy_P(name, pname, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        int pos = registry_search(name);
+        if ( pos >= 0 ) {
+            continue; /* already registered; the first one wins */
+        }
+        if ( registry_count >= MSH_COMMANDS_MAX ) {
+            return -1;
+        }
+        pos = -pos - 1;
+        memmove(&registry[pos + 1], &registry[pos],
+                (registry_count - pos) * sizeof(registry[0]));
+#ifdef MSH_CONFIG_STATS
+        memmove(&command_stats[pos + 1], &command_stats[pos],
+                (registry_count - pos) * sizeof(command_stats[0]));
+        memset(&command_stats[pos], 0, sizeof(command_stats[0]));
+#endif
+        registry[pos] = &cmdlist[i];
+        registry_count++;
+    }
+    return 0;
+}
+
+
+const msh_command_entry* msh_find_command(const char* name)
+{
+    int pos = registry_search(name);
+    return ( pos >= 0 ) ? registry[pos] : NULL;
+}
+
+
+/* ***************************************************************************
+ *                    typed arguments (see msh_args)
+ * ***************************************************************************/
+static int8_t hexdigit(char c)
+{
+    if ( c >= '0' && c <= '9' ) {
+        return c - '0';
+    }
+    c |= 0x20; /* lower case */
+    if ( c >= 'a' && c <= 'f' ) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* Parse a decimal number, with no sign, up to 0xFFFFFFFF. */
+static bool parse_uint(const char* s, uint32_t* n)
+{
+    uint32_t v = 0;
+
+    if ( *s == '\0' ) {
+        return false;
+    }
+    for ( ;  *s != '\0';  s++ ) {
+        uint8_t d = *s - '0';
+        if ( d > 9 || v > (0xFFFFFFFFUL - d) / 10 ) {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    *n = v;
+    return true;
+}
+
+/* A number in the schema (in flash) */
+static const char* schema_uint(const char* p, uint32_t* n)
+{
+    char c;
+
+    *n = 0;
+    while ( (c = pgm_read_byte(p)) >= '0' && c <= '9' ) {
+        *n = *n * 10 + (c - '0');
+        p++;
+    }
+    return p;
+}
+
+/*
+ * Convert 'arg' to the type at 'p' in the schema, into 'v'. Sets *ok, false
+ * also if 'arg' is NULL. Returns the schema past the type.
+ */
+static const char*
+convert_arg(const char* p, const char* arg, msh_value* v, bool* ok)
+{
+    char     t = pgm_read_byte(p++);
+    uint32_t n;
+    uint32_t lo = 0;
+    uint32_t hi = ( t == 'b' ) ? 0xFF : ( t == 'w' ) ? 0xFFFF : 0xFFFFFFFFUL;
+    uint8_t  i;
+
+    *ok = false;
+    switch ( t ) {
+        case 'b':
+        case 'w':
+        case 'l':
+            if ( pgm_read_byte(p) == '[' ) {
+                p = schema_uint(p + 1, &lo);  /* '-' */
+                p = schema_uint(p + 1, &hi);  /* ']' */
+                p++;
+            }
+            if ( arg && parse_uint(arg, &n) && n >= lo && n <= hi ) {
+                v->u32 = 0;
+                if ( t == 'b' ) {
+                    v->u8 = n;
+                } else if ( t == 'w' ) {
+                    v->u16 = n;
+                } else {
+                    v->u32 = n;
+                }
+                *ok = true;
+            }
+            break;
+
+        case 'x':
+            if ( arg && strlen(arg) == 6 ) {
+                *ok = true;
+                for ( i = 0;  i < 6;  i++ ) {
+                    int8_t d = hexdigit(arg[i]);
+                    if ( d < 0 ) {
+                        *ok = false;
+                        break;
+                    }
+                    v->rgb[i / 2] = ( i % 2 ) ? (v->rgb[i / 2] | d) : d << 4;
+                }
+            }
+            break;
+
+        case '9':
+            if ( arg && strlen(arg) == 3 ) {
+                *ok = true;
+                for ( i = 0;  i < 3;  i++ ) {
+                    if ( arg[i] < '0' || arg[i] > '9' ) {
+                        *ok = false;
+                        break;
+                    }
+                    v->rgb[i] = (arg[i] - '0') * 255 / 9;
+                }
+            }
+            break;
+
+        case 's':
+            v->str = arg;
+            *ok = ( arg != NULL );
+            break;
+
+        case '(':
+            /* compare 'arg' with each word, until ')' */
+            for ( i = 0;  ;  i++ ) {
+                const char* a = arg;
+                char c;
+                while ( (c = pgm_read_byte(p)) != '|' && c != ')' ) {
+                    if ( a && *a == c ) {
+                        a++;
+                    } else {
+                        a = NULL;
+                    }
+                    p++;
+                }
+                p++;
+                if ( a && *a == '\0' && ! *ok ) {
+                    v->u8 = i;
+                    *ok = true;
+                }
+                if ( c == ')' ) {
+                    break;
+                }
+            }
+            break;
+    }
+    return p;
+}
+
+/*
+ * Convert argv[1...] by the form of the schema at 'p', up to '|' or the
+ * end. Returns 0 if all of them matched, -1 if the number of them doesn't
+ * fit the form, or the index of the first one which didn't match.
+ */
+static int convert_form(const char* p, int argc, const char** argv, msh_args* args)
+{
+    const char* form = p;
+    msh_value none;
+    int  min = 0;
+    int  max = 0;
+    bool optional = false;
+    bool ok;
+    char c;
+
+    /* count the arguments first, not to blame one for a missing one */
+    while ( (c = pgm_read_byte(p)) != '\0' && c != '|' ) {
+        if ( c == '?' ) {
+            optional = true;
+            p++;
+            continue;
+        }
+        p = convert_arg(p, NULL, &none, &ok);
+        if ( pgm_read_byte(p) == '*' ) {
+            max = MSH_CMDARGS_MAX;
+            p++;
+        } else {
+            min += ! optional;
+            max++;
+        }
+    }
+    if ( argc - 1 < min || argc - 1 > max ) {
+        return -1;
+    }
+
+    int i = 1;
+    p = form;
+    while ( i < argc ) {
+        if ( pgm_read_byte(p) == '?' ) {
+            p++;
+        }
+        const char* type = p;
+        p = convert_arg(type, argv[i], &args->v[i - 1], &ok);
+        if ( ! ok ) {
+            return i;
+        }
+        i++;
+        if ( pgm_read_byte(p) == '*' ) {
+            p = type; /* again */
+        }
+    }
+    args->count = argc - 1;
+    return 0;
+}
+
+/* The form after the one at 'p' in a schema, or NULL if it's the last. */
+static const char* next_form(const char* p)
+{
+    int  depth = 0;
+    char c;
+
+    /* up to a '|' out of (...) */
+    while ( (c = pgm_read_byte(p)) != '\0' && ( c != '|' || depth > 0 ) ) {
+        depth += ( c == '(' ) - ( c == ')' );
+        p++;
+    }
+    return ( c == '\0' ) ? NULL : p + 1;
+}
+
+/*
+ * Convert argv[] by 'schema' (in flash) into 'args'. Returns true if one
+ * of the forms matched; or else sets *bad to the index of the argument
+ * which didn't match, or 0 if the number of them didn't fit any form.
+ */
+static bool convert_args(const char* schema, int argc, const char** argv,
+                         msh_args* args, int* bad)
+{
+    const char* p = schema;
+
+    *bad = 0;
+    args->form = 0;
+    while ( 1 ) {
+        int r = convert_form(p, argc, argv, args);
+        if ( r == 0 ) {
+            return true;
+        }
+        if ( r > *bad ) {
+            *bad = r;  /* the one which went the furthest */
+        }
+        p = next_form(p);
+        if ( p == NULL ) {
+            return false;
+        }
+        args->form++;
+    }
+}
+
+static void put_args_error(const char** argv, int bad)
+{
+    if ( bad > 0 ) {
+        msh_puts_P(PSTR("Error: bad argument: '"));
+        pico_puts(argv[bad]);
+        msh_puts_P(PSTR("'\n"));
+    } else {
+        msh_puts_P(PSTR("Error: wrong number of arguments.\n"));
+    }
+}
+
+
+/*
+ * Packed arguments, converted once (see msh_pack_args()):
+ *
+ *     form  count  value ...
+ *
+ * each value taking as many bytes as its type needs, in the same layout
+ * as in msh_value: 1 for b and (...), 2 for w, 4 for l, 3 for x and 9,
+ * and a string with its '\0' for s.
+ */
+
+/* The type of the next argument at *p in a form, moving *p past it. */
+static const char* form_next_type(const char** p)
+{
+    msh_value none;
+    bool ok;
+
+    if ( pgm_read_byte(*p) == '?' ) {
+        (*p)++;
+    }
+    const char* type = *p;
+    *p = convert_arg(type, NULL, &none, &ok);
+    if ( pgm_read_byte(*p) == '*' ) {
+        *p = type; /* again */
+    }
+    return type;
+}
+
+/* The form 'n' of 'schema' */
+static const char* schema_form(const char* schema, uint8_t n)
+{
+    while ( n-- > 0 ) {
+        schema = next_form(schema);
+    }
+    return schema;
+}
+
+static uint8_t value_size(char type, const msh_value* v)
+{
+    switch ( type ) {
+        case 'w':
+            return 2;
+        case 'l':
+            return 4;
+        case 'x':
+        case '9':
+            return 3;
+        case 's':
+            return strlen(v->str) + 1;
+        default:
+            return 1;
+    }
+}
+
+/* Unpack 'buf' into 'args'; strings point into 'buf'. */
+static void unpack_args(const char* schema, const uint8_t* buf, msh_args* args)
+{
+    args->form  = *buf++;
+    args->count = *buf++;
+
+    const char* p = schema_form(schema, args->form);
+    for ( uint8_t i = 0;  i < args->count;  i++ ) {
+        char t = pgm_read_byte(form_next_type(&p));
+        msh_value* v = &args->v[i];
+        v->u32 = 0;
+        if ( t == 's' ) {
+            v->str = (const char*)buf;
+        } else {
+            memcpy(v, buf, value_size(t, v));
+        }
+        buf += value_size(t, v);
+    }
+}
+
 /*
- * Find a command 'argv[0]' from cmdlist (using find_command_entry())
- * and executes it.
+ * Call the handler of a command, converting the arguments if it's typed,
+ * or with 'args' if they're converted already.
+ */
+static int call_entry(const msh_command_entry* cmd_entry, int argc, const char** argv,
+                      const msh_args* args)
+{
+    msh_typed_func typed = entry_typed(cmd_entry);
+    msh_args converted;
+    int bad;
+
+    if ( typed == NULL ) {
+        return entry_func(cmd_entry)(argc, argv);
+    }
+    if ( args == NULL ) {
+        if ( ! convert_args(entry_schema(cmd_entry), argc, argv, &converted, &bad) ) {
+            put_args_error(argv, bad);
+            return 1;
+        }
+        args = &converted;
+    }
+    return typed(args);
+}
+
+
+/*
+ * Run a command, counting it in command_stats[pos] if pos >= 0.
+ */
+static int
+run_command(const msh_command_entry* cmd_entry, int pos, int argc, const char** argv,
+            const msh_args* args)
+{
+#ifdef MSH_CONFIG_STATS
+    unsigned long t0 = pico_micros();
+    int ret = call_entry(cmd_entry, argc, argv, args);
+    unsigned long us = pico_micros() - t0;
+
+    msh_stats.dispatch_us += us;
+    if ( pos >= 0 ) {
+        command_stats[pos].calls++;
+        if ( us > command_stats[pos].max_us ) {
+            command_stats[pos].max_us = us;
+        }
+    }
+    return ret;
+#else
+    return call_entry(cmd_entry, argc, argv, args);
+#endif
+}
+
+
+int msh_exec_command(int argc, const char** argv)
+{
+    int pos;
+
+    if ( argc < 1 ) {
+        return -1;
+    }
+    pos = registry_search(argv[0]);
+    if ( pos < 0 ) {
+        return -1;
+    }
+    return run_command(registry[pos], pos, argc, argv, NULL);
+}
+
+
+int msh_command_index(const char* name)
+{
+    int pos = registry_search(name);
+    return ( pos >= 0 ) ? pos : -1;
+}
+
+
+const char* msh_command_name(int index)
+{
+    if ( index < 0 || index >= registry_count ) {
+        return NULL;
+    }
+    return entry_name(registry[index]);
+}
+
+
+int msh_exec_index(int index, int argc, const char** argv)
+{
+    if ( index < 0 || index >= registry_count || argc < 1 ) {
+        return -1;
+    }
+    return run_command(registry[index], index, argc, argv, NULL);
+}
+
+
+const char* msh_command_schema(int index)
+{
+    if ( index < 0 || index >= registry_count ) {
+        return NULL;
+    }
+    return entry_schema(registry[index]);
+}
+
+
+int msh_pack_args(int index, int argc, const char** argv, uint8_t* buf, int size)
+{
+    msh_args args;
+    int bad;
+
+    if ( index < 0 || index >= registry_count || entry_typed(registry[index]) == NULL ) {
+        return 0;
+    }
+    const char* schema = entry_schema(registry[index]);
+    if ( ! convert_args(schema, argc, argv, &args, &bad) ) {
+        put_args_error(argv, bad);
+        return -1;
+    }
+    if ( size < 2 ) {
+        return -2;
+    }
+    buf[0] = args.form;
+    buf[1] = args.count;
+
+    int used = 2;
+    const char* p = schema_form(schema, args.form);
+    for ( uint8_t i = 0;  i < args.count;  i++ ) {
+        const msh_value* v = &args.v[i];
+        char t = pgm_read_byte(form_next_type(&p));
+        uint8_t n = value_size(t, v);
+        if ( used + n > size ) {
+            return -2;
+        }
+        memcpy(buf + used, ( t == 's' ) ? (const void*)v->str : (const void*)v, n);
+        used += n;
+    }
+    return used;
+}
+
+
+int msh_exec_packed(int index, const uint8_t* buf)
+{
+    msh_args args;
+
+    if ( index < 0 || index >= registry_count || entry_typed(registry[index]) == NULL ) {
+        return -1;
+    }
+    unpack_args(entry_schema(registry[index]), buf, &args);
+    return run_command(registry[index], index, 0, NULL, &args);
+}
+
+
+static void put_number(unsigned long n, int width)
+{
+    char buf[11];
+    int  i = sizeof(buf);
+
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while ( n > 0 );
+    for ( width -= sizeof(buf) - i;  width > 0;  width-- ) {
+        pico_putchar(' ');
+    }
+    pico_write(&buf[i], sizeof(buf) - i);
+}
+
+void msh_print_packed(int index, const uint8_t* buf)
+{
+    static const char hex[] PROGMEM = "0123456789abcdef";
+    msh_args args;
+
+    if ( index < 0 || index >= registry_count || entry_typed(registry[index]) == NULL ) {
+        return;
+    }
+    const char* schema = entry_schema(registry[index]);
+    unpack_args(schema, buf, &args);
+
+    const char* p = schema_form(schema, args.form);
+    for ( uint8_t i = 0;  i < args.count;  i++ ) {
+        const msh_value* v = &args.v[i];
+        const char* type = form_next_type(&p);
+        uint8_t j;
+
+        pico_putchar(' ');
+        switch ( pgm_read_byte(type) ) {
+            case 'b':
+                put_number(v->u8, 0);
+                break;
+            case 'w':
+                put_number(v->u16, 0);
+                break;
+            case 'l':
+                put_number(v->u32, 0);
+                break;
+            case 'x':
+                for ( j = 0;  j < 3;  j++ ) {
+                    pico_putchar(pgm_read_byte(&hex[v->rgb[j] >> 4]));
+                    pico_putchar(pgm_read_byte(&hex[v->rgb[j] & 0x0F]));
+                }
+                break;
+            case '9':
+                for ( j = 0;  j < 3;  j++ ) {
+                    pico_putchar('0' + (v->rgb[j] * 9 + 127) / 255);
+                }
+                break;
+            case 's':
+                if ( *v->str == '\0' || strpbrk(v->str, " ;{}") != NULL ) {
+                    pico_putchar('\'');
+                    pico_puts(v->str);
+                    pico_putchar('\'');
+                } else {
+                    pico_puts(v->str);
+                }
+                break;
+            case '(':
+                /* the word v->u8, from 0 */
+                for ( j = 0, type++;  j < v->u8;  type++ ) {
+                    j += ( pgm_read_byte(type) == '|' );
+                }
+                while ( pgm_read_byte(type) != '|' && pgm_read_byte(type) != ')' ) {
+                    pico_putchar(pgm_read_byte(type++));
+                }
+                break;
+        }
+    }
+}
+
+
+/* Is 'e' one of the entries in 'cmdlist'? */
+static bool list_has_entry(const msh_command_entry* cmdlist, const msh_command_entry* e)
+{
+    for ( ;  entry_name(cmdlist) != NULL;  cmdlist++ ) {
+        if ( cmdlist == e ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Find a command 'argv[0]' from cmdlist and executes it. The registry is
+ * searched once, and its index is kept for the stats; cmdlist is searched
+ * by name (using find_command_entry()) only if the one registered is not
+ * in cmdlist.
  */
 int msh_do_command(const msh_command_entry* cmdlist, int argc, const char** argv)
 {
     const msh_command_entry* cmd_entry;
+    int pos;
 
     if ( argc < 1 ) {
         return -1;
     }
 
+    pos = registry_search(argv[0]);
+    if ( pos >= 0 && list_has_entry(cmdlist, registry[pos]) ) {
+        return run_command(registry[pos], pos, argc, argv, NULL);
+    }
     cmd_entry = find_command_entry(cmdlist, argv[0]);
 
     if ( cmd_entry != NULL ) {
-        return ( cmd_entry->func(argc, argv) );
+        /* not the registered one; count the time only */
+        return run_command(cmd_entry, -1, argc, argv, NULL);
     } else {
         /*
-        pico_puts("command not found: ");
+        msh_puts_P(PSTR("command not found: "));
         pico_puts(argv[0]);
-        pico_puts("\n");
+        msh_puts_P(PSTR("\n"));
         */
         return -1;
     }
 }
 
+
+#ifdef MSH_CONFIG_STATS
+static void put_stat(const char* label, unsigned long n, const char* unit)
+{
+    msh_puts_P(label);
+    put_number(n, 20 - strlen_P(label));
+    msh_puts_P(unit);
+}
+
+static int cmd_stats(int argc, const char** argv)
+{
+    int i;
+
+    if ( argc == 2 && strcmp(argv[1], "reset") == 0 ) {
+        memset(&msh_stats, 0, sizeof(msh_stats));
+        memset(command_stats, 0, sizeof(command_stats));
+        return 0;
+    }
+    if ( argc != 1 ) {
+        return 1;
+    }
+    put_stat(PSTR("bytes in"),      msh_stats.bytes_in,      PSTR("\n"));
+    put_stat(PSTR("bytes out"),     msh_stats.bytes_out,     PSTR("\n"));
+    put_stat(PSTR("writes"),        msh_stats.writes,        PSTR("\n"));
+    put_stat(PSTR("write time"),    msh_stats.write_us,      PSTR(" us\n"));
+    put_stat(PSTR("xoff"),          msh_stats.xoff,          PSTR("\n"));
+    put_stat(PSTR("rx full"),       msh_stats.rx_full,       PSTR("\n"));
+    put_stat(PSTR("lines"),         msh_stats.lines,         PSTR("\n"));
+    put_stat(PSTR("commands"),      msh_stats.commands,      PSTR("\n"));
+    put_stat(PSTR("syntax errors"), msh_stats.syntax_errors, PSTR("\n"));
+    put_stat(PSTR("parse time"),    msh_stats.parse_us,      PSTR(" us\n"));
+    put_stat(PSTR("command time"),  msh_stats.dispatch_us,   PSTR(" us\n"));
+
+    msh_puts_P(PSTR("command        calls     max us\n"));
+    for ( i = 0;  i < registry_count;  i++ ) {
+        if ( command_stats[i].calls == 0 ) {
+            continue;
+        }
+        const char* name = entry_name(registry[i]);
+        msh_puts_P(name);
+        put_number(command_stats[i].calls, 20 - strlen_P(name));
+        put_number(command_stats[i].max_us, 11);
+        pico_putchar('\n');
+    }
+    return 0;
+}
+#endif
+
+
 #ifdef MSH_CONFIG_HELP
-void msh_print_cmdlist(const msh_command_entry* cmdlist)
+static void print_command_entry(const msh_command_entry* cmd_entry)
 {
-    int i, j;
+    int j;
     const int indent = 10;
+    const char* name = entry_name(cmd_entry);
+    const char* desc = (const char*)pgm_read_ptr(&cmd_entry->description);
 
-    i = 0;
-    while ( cmdlist[i].name != NULL ) {
-            pico_puts("    ");
-            pico_puts(cmdlist[i].name);
-            for (j = indent - strlen(cmdlist[i].name);  j > 0;  j--) {
-                pico_putchar(' ');
-            }
-            pico_puts("- ");
-            if ( cmdlist[i].description != NULL ) {
-                pico_puts(cmdlist[i].description);
-                pico_puts("\n");
-            } else {
-                pico_puts("(No description available)\n");
-            }
-        i++;
+    msh_puts_P(PSTR("    "));
+    msh_puts_P(name);
+    for (j = indent - strlen_P(name);  j > 0;  j--) {
+        pico_putchar(' ');
+    }
+    msh_puts_P(PSTR("- "));
+    if ( desc != NULL ) {
+        msh_puts_P(desc);
+        msh_puts_P(PSTR("\n"));
+    } else {
+        msh_puts_P(PSTR("(No description available)\n"));
     }
-    return;
 }
 
+void msh_print_cmdlist(const msh_command_entry* cmdlist)
+{
+    int i;
+    for ( i = 0;  entry_name(&cmdlist[i]) != NULL;  i++ ) {
+        print_command_entry(&cmdlist[i]);
+    }
+}
 
-const char* msh_get_command_usage(const msh_command_entry* cmdlist, const char* cmdname)
+void msh_print_commands(void)
 {
-    const msh_command_entry* cmd_entry;
+    int i;
+    for ( i = 0;  i < registry_count;  i++ ) {
+        print_command_entry(registry[i]);
+    }
+}
+
+static const char no_help[] PROGMEM = "No help available.\n";
+
+static const char* command_usage(const msh_command_entry* cmd_entry)
+{
+    const char* usage;
 
-    cmd_entry = find_command_entry(cmdlist, cmdname);
     if ( cmd_entry == NULL ) {
         return NULL; /* No such command */
-    } else if ( cmd_entry->usage == NULL ) {
-        return "No help available.\n";
-    } else {
-        return cmd_entry->usage;
     }
+    usage = (const char*)pgm_read_ptr(&cmd_entry->usage);
+    return ( usage != NULL ) ? usage : no_help;
+}
+
+const char* msh_get_usage(const char* cmdname)
+{
+    return command_usage( msh_find_command(cmdname) );
+}
+
+
+const char* msh_get_command_usage(const msh_command_entry* cmdlist, const char* cmdname)
+{
+    return command_usage( find_command_entry(cmdlist, cmdname) );
 }
 #else
+static const char no_help[] PROGMEM = "No help available.\n";
+
 void msh_print_cmdlist(const msh_command_entry* cmdlist) { /* do nothing */ }
+void msh_print_commands(void) { /* do nothing */ }
 const char* msh_get_command_usage(const msh_command_entry* cmdlist, const char* cmdname)
 {
-    return "No help available.\n";
+    return no_help;
+}
+const char* msh_get_usage(const char* cmdname)
+{
+    return no_help;
 }
 #endif /*MSH_CONFIG_HELP*/
 #include "history.h"
@@ -201,70 +1055,120 @@ const char* msh_get_command_usage(const msh_command_entry* cmdlist, const char*
 
 /*
  * Easy, we have only one history, the global history.
+ *
+ * Lines are packed in history[] one after another, each terminated by
+ * '\0', from the oldest to the latest. When a new line doesn't fit,
+ * the oldest ones are dropped and the rest is slid to the head. So every
+ * line stays contiguous and history_get() can return it as it is.
  */
-static char history[MSH_CMD_HISTORY_MAX][MSH_CMDLINE_CHAR_MAX];
-static bool histfull;
-static int  histlast;
+static char history[MSH_CMD_HISTORY_BYTES];
+static int  histused; /* bytes used, including the '\0's */
 
 
 void history_append(const char* line)
 {
     /* If a given string is too long or zero-length, just ignore.*/
     int len = strlen(line);
-    if ( len >= MSH_CMDLINE_CHAR_MAX || len <= 0) {
+    if ( len >= MSH_CMDLINE_CHAR_MAX || len <= 0
+         || len + 1 > MSH_CMD_HISTORY_BYTES ) {
         return;
     }
 
-    strcpy(history[histlast], line);
+    /* Don't repeat the same line as the latest one */
+    const char* latest = history_get(0);
+    if ( latest != NULL && strcmp(latest, line) == 0 ) {
+        return;
+    }
 
-    if ( histlast >= MSH_CMD_HISTORY_MAX - 1 ) {
-        histfull = true;
-        histlast = 0;
-    } else {
-        histlast++;
+    /* Drop the oldest lines to make a room */
+    int drop = 0;
+    while ( histused - drop + len + 1 > MSH_CMD_HISTORY_BYTES ) {
+        drop += strlen(&history[drop]) + 1;
+    }
+    if ( drop > 0 ) {
+        histused -= drop;
+        memmove(history, &history[drop], histused);
     }
+
+    memcpy(&history[histused], line, len + 1);
+    histused += len + 1;
 }
 
 
 const char* history_get(int histnum)
 {
-    if ( ! histfull ) {
-        if ( histnum >= histlast ) {
-            return NULL;
+    int end = histused; /* next to the '\0' of the line */
+
+    if ( histnum < 0 ) {
+        return NULL;
+    }
+    while ( end > 0 ) {
+        int start = end - 1;
+        while ( start > 0 && history[start - 1] != '\0' ) {
+            start--;
+        }
+        if ( histnum == 0 ) {
+            return &history[start];
         }
+        histnum--;
+        end = start;
     }
-    else
-    if ( histnum > MSH_CMD_HISTORY_MAX - 1 || histnum < 0 ) {
-        return NULL;
+    return NULL;
+}
+
+
+
+#ifdef TEST
+#include "test.h"
+int main(void)
+{
+    return 0;
+}
+#endif
+#endif/*MSH_CONFIG_CMDHISTORY*/
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "picoshell_termesc.h"
+#include "history.h"
+
+
+/*
+ * All output of the line editor goes through echo_*(), so that it can be
+ * turned off as a whole (e.g. when a program, not a human, is typing).
+ */
+static int bEcho = 1;
+
+void msh_set_echo(int enable)
+{
+    bEcho = enable;
+}
+
+static inline void echo_putchar( int c )
+{
+    if ( bEcho ) {
+        pico_putchar(c);
     }
+}
 
-    if ( histlast > histnum ) {
-        return ( history[histlast - histnum - 1] );
-    } else {
-        return history[ MSH_CMD_HISTORY_MAX - (histnum - histlast)  - 1];
+static inline void echo_puts( const char* s )
+{
+    if ( bEcho ) {
+        pico_puts(s);
     }
 }
 
-
-
-#ifdef TEST
-#include "test.h"
-int main(void)
+static inline void echo_write( const char* buf, int len )
 {
-    return 0;
+    if ( bEcho ) {
+        pico_write(buf, len);
+    }
 }
-#endif
-#endif/*MSH_CONFIG_CMDHISTORY*/
-#include <stdio.h>
-#include <string.h>
-#include <ctype.h>
-
-#include "picoshell_termesc.h"
-#include "history.h"
 
 
 #ifdef MSH_CONFIG_ENABLE_BELL
-#define ring_terminal_bell() pico_putchar('\a');
+#define ring_terminal_bell() echo_putchar('\a');
 #else
 #define ring_terminal_bell() /* disable */
 #endif
@@ -317,6 +1221,87 @@ void msh_set_prompt(char* str)
     prompt_string = str;
 }
 
+
+/* ************************************************************************* *
+ *     Terminal Output
+ *     With a VT100 terminal, redraws use CSI sequences to send only what
+ *     changed. Otherwise, the rest of line is reprinted and the cursor is
+ *     moved back by '\b', which any terminal understands.
+ * ************************************************************************* */
+#ifdef MSH_CONFIG_VT100
+static int bTermVT100 = 1;
+#else
+static int bTermVT100 = 0;
+#endif
+
+void msh_set_vt100(int enable)
+{
+    bTermVT100 = enable;
+}
+
+int msh_get_vt100(void)
+{
+    return bTermVT100;
+}
+
+/** term_csi()
+ * Send "ESC [ n cmd". 'n' is omitted if it's 0 or 1, the defaults.
+ */
+static void
+term_csi( int n, char cmd )
+{
+    char numbuf[4];
+    int  i = sizeof(numbuf);
+
+    echo_puts("\033[");
+    if ( n > 1 ) {
+        do {
+            numbuf[--i] = '0' + n % 10;
+            n /= 10;
+        } while ( n > 0 && i > 0 );
+        echo_write(&numbuf[i], sizeof(numbuf) - i);
+    }
+    echo_putchar(cmd);
+}
+
+/** term_cursor_back()
+ * Move the cursor n chars to the left.
+ */
+static void
+term_cursor_back( int n )
+{
+    /* "ESC[nD" is 4 bytes or more, so '\b's are not longer for n < 4 */
+    if ( bTermVT100 && n >= 4 ) {
+        term_csi(n, 'D');
+    } else {
+        while ( n-- > 0 ) {
+            echo_putchar('\b');
+        }
+    }
+}
+
+/** term_erase_tail()
+ * Erase n chars on and right of the cursor. The cursor doesn't move.
+ */
+static void
+term_erase_tail( int n )
+{
+    int i;
+    if ( n <= 0 ) {
+        return;
+    }
+    if ( bTermVT100 ) {
+        term_csi(0, 'K');
+    } else {
+        for ( i = 0;  i < n;  i++ ) {
+            echo_putchar(' ');
+        }
+        for ( i = 0;  i < n;  i++ ) {
+            echo_putchar('\b');
+        }
+    }
+}
+
 /* ************************************************************************* *
  *     Basic Line Edit Functions (Enabled regardless of MSH_CONFIG_LINEEDIT)
  * ************************************************************************* */
@@ -327,16 +1312,8 @@ void msh_set_prompt(char* str)
 static void
 cmdline_kill( cmdline_t* pcmdline )
 {
-    int i;
-    for ( i = 0;  i < pcmdline->pos;  i++ ) {
-        pico_putchar('\b');
-    }
-    for ( i = 0;  i < pcmdline->linelen;  i++ ) {
-        pico_putchar(' ');
-    }
-    for ( i = 0;  i < pcmdline->linelen;  i++ ) {
-        pico_putchar('\b');
-    }
+    term_cursor_back( pcmdline->pos );
+    term_erase_tail( pcmdline->linelen );
     cmdline_clear( pcmdline );
 }
 
@@ -353,7 +1330,7 @@ cmdline_set( cmdline_t* pcmdline, const char* str )
     cmdline_kill(pcmdline);
     len = strlen(str);
     strcpy( pcmdline->buf, str );
-    pico_puts( str );
+    echo_puts( str );
     pcmdline->pos     = len;
     pcmdline->linelen = len;
 }
@@ -372,18 +1349,24 @@ cmdline_insert_char( cmdline_t* pcmdline, unsigned char c )
         return 0;
     }
 
-    pico_putchar(c);
     /* Is cursor at the end of the cmdline ? */
     if ( pcmdline->pos == pcmdline->linelen ) {
         /* just append */
+        echo_putchar(c);
         pcmdline->buf[ pcmdline->pos ] = c;
     } else {
         /* slide the strings after the cursor to the right */
         int i;
-        pico_puts(  & pcmdline->buf[ pcmdline->pos ]  );
+        if ( bTermVT100 ) {
+            term_csi(1, '@'); /* open a blank at the cursor */
+            echo_putchar(c);
+        } else {
+            echo_putchar(c);
+            echo_puts(  & pcmdline->buf[ pcmdline->pos ]  );
+            term_cursor_back( pcmdline->linelen - pcmdline->pos );
+        }
         for (i = pcmdline->linelen;  i > pcmdline->pos;  i--) {
             pcmdline->buf[ i ] = pcmdline->buf[ i - 1 ];
-            pico_putchar('\b');
         }
         pcmdline->buf[ pcmdline->pos ] = c;
     }
@@ -405,23 +1388,26 @@ cmdline_backspace( cmdline_t* pcmdline )
         ring_terminal_bell();
         return 0;
     }
-    pico_putchar('\b');
+    echo_putchar('\b');
     /* Is cursor at the end of the cmdline ? */
     if ( pcmdline->pos == pcmdline->linelen ) {
-        pico_putchar(' ');
-        pico_putchar('\b');
+        echo_putchar(' ');
+        echo_putchar('\b');
     } else {
         int i;
         /* slide the characters after cursor position to the left */
         for ( i = pcmdline->pos;  i < pcmdline->linelen;  i++ ) {
             pcmdline->buf[i-1] = pcmdline->buf[i];
-            pico_putchar( pcmdline->buf[i] );
         }
-        pico_putchar(' ');
-        /* put the cursor to its orignlal position */
-        /* +1 in for () is for pico_putchar(' ') in the previous line */
-        for ( i = pcmdline->pos;  i < pcmdline->linelen + 1;  i++ ) {
-            pico_putchar('\b');
+        if ( bTermVT100 ) {
+            term_csi(1, 'P'); /* delete a char at the cursor */
+        } else {
+            echo_write( &pcmdline->buf[ pcmdline->pos - 1 ],
+                        pcmdline->linelen - pcmdline->pos );
+            echo_putchar(' ');
+            /* put the cursor to its orignlal position */
+            /* +1 is for echo_putchar(' ') in the previous line */
+            term_cursor_back( pcmdline->linelen - pcmdline->pos + 1 );
         }
     }
     pcmdline->buf[ pcmdline->linelen - 1 ] = '\0';
@@ -450,12 +1436,15 @@ cmdline_delete( cmdline_t* pcmdline )
         /* slide the chars on and after cursor position to the left */
         for ( i = pcmdline->pos;  i < pcmdline->linelen - 1;  i++ ) {
             pcmdline->buf[i] = pcmdline->buf[ i + 1 ];
-            pico_putchar( pcmdline->buf[i] );
         }
-        pico_putchar(' ');
-        /* put the cursor to its orignlal position */
-        for ( i = pcmdline->pos;  i < pcmdline->linelen;  i++ ) {
-            pico_putchar('\b');
+        if ( bTermVT100 ) {
+            term_csi(1, 'P'); /* delete a char at the cursor */
+        } else {
+            echo_write( &pcmdline->buf[ pcmdline->pos ],
+                        pcmdline->linelen - 1 - pcmdline->pos );
+            echo_putchar(' ');
+            /* put the cursor to its orignlal position */
+            term_cursor_back( pcmdline->linelen - pcmdline->pos );
         }
 
     }
@@ -478,7 +1467,7 @@ static int
 cmdline_cursor_left( cmdline_t* pcmdline )
 {
     if ( pcmdline->pos > 0 ) {
-        pico_putchar('\b');
+        echo_putchar('\b');
         pcmdline->pos--;
         return 1;
     }
@@ -493,7 +1482,7 @@ static int
 cmdline_cursor_right( cmdline_t* pcmdline )
 {
     if ( pcmdline->pos < pcmdline->linelen ) {
-        pico_putchar( pcmdline->buf[pcmdline->pos++] );
+        echo_putchar( pcmdline->buf[pcmdline->pos++] );
         return 1;
     }
     else
@@ -510,18 +1499,20 @@ cmdline_cursor_right( cmdline_t* pcmdline )
 static void
 cmdline_cursor_linehead( cmdline_t* pcmdline )
 {
-    while ( pcmdline->pos > 0 ) {
-        pico_putchar('\b');
-        pcmdline->pos--;
-    }
+    term_cursor_back( pcmdline->pos );
+    pcmdline->pos = 0;
 }
 
 static void
 cmdline_cursor_linetail( cmdline_t* pcmdline )
 {
-    while ( pcmdline->pos < pcmdline->linelen ) {
-        pico_putchar( pcmdline->buf[pcmdline->pos++] );
+    int n = pcmdline->linelen - pcmdline->pos;
+    if ( bTermVT100 && n >= 4 ) {
+        term_csi(n, 'C');
+    } else {
+        echo_write( &pcmdline->buf[ pcmdline->pos ], n );
     }
+    pcmdline->pos = pcmdline->linelen;
 }
 
 #ifdef MSH_CONFIG_CLIPBOARD
@@ -551,7 +1542,6 @@ cmdline_yank( cmdline_t* pcmdline )
 static void
 cmdline_killtail( cmdline_t* pcmdline )
 {
-    int i;
     if ( pcmdline->pos == pcmdline->linelen ) {
         /* nothing to kill */
         ring_terminal_bell();
@@ -561,12 +1551,7 @@ cmdline_killtail( cmdline_t* pcmdline )
     strcpy( pcmdline->clipboard, &pcmdline->buf[pcmdline->pos] );
 
     /* erase chars on and right of the cursor on terminal */
-    for ( i = pcmdline->pos;  i < pcmdline->linelen; i++ ) {
-        pico_putchar(' ');
-    }
-    for ( i = pcmdline->pos;  i < pcmdline->linelen; i++ ) {
-        pico_putchar('\b');
-    }
+    term_erase_tail( pcmdline->linelen - pcmdline->pos );
 
     /* erase chars on and right of the cursor in buf */
     pcmdline->buf[pcmdline->pos] = '\0';
@@ -635,52 +1620,141 @@ cmdline_killword( cmdline_t* pcmdline )
     /* temporary buffer to hold history */
     const char* histline;
 #endif
+
+/*
+ * Escape sequences from the terminal, decoded one char per call so that
+ * the input loop never blocks in the middle of one:
+ *
+ *   ESC [ <n>;... <final>  CSI: arrows A-D, Home H, End F, and for '~',
+ *                          Home 1/7, Delete 3, End 4/8, and bracketed
+ *                          paste begin 200 / end 201. Only the first
+ *                          parameter counts, so modified keys like
+ *                          ESC[1;5C (Ctrl-Right) work as plain ones.
+ *   ESC O <final>          SS3: arrows, Home and End in application mode
+ *
+ * Other sequences are consumed whole and ignored. If the next char of a
+ * sequence doesn't come in MSH_ESC_TIMEOUT_MS, the sequence is dropped
+ * and the char is taken afresh, so a lone ESC can't swallow a key.
+ */
+enum {
+    ESC_STATE_NONE,
+    ESC_STATE_ESC,    /* got '\033' */
+    ESC_STATE_CSI,    /* got '\033[', and maybe digits of the 1st parameter */
+    ESC_STATE_PARAMS, /* in the parameters after the 1st */
+    ESC_STATE_SS3,    /* got '\033O' */
+};
+static unsigned char esc_state;
+static unsigned char esc_param;  /* the 1st parameter; 255 if larger */
+static unsigned char esc_paste;  /* between bracketed paste markers */
+static unsigned long esc_ms;     /* when the last char of a sequence came */
+
+#define ESC_CONSUMED  (-1)
+
+/* the keybind of a sequence ending with 'final' */
 static int
-cursor_inputchar( cmdline_t* pcmdline, unsigned char c )
+esc_key( unsigned char final, unsigned char param )
 {
-    unsigned char input = c;
-
-    /* QUICK HACK
-     * Map escape sequences (Arrow keys) to other bind - work only for limited types of terminals
-     */
-    if (input == '\033' ) {
-        char second, third;
-        second = pico_getchar();
-        third = pico_getchar();
-        if ( second == '[' ) {
-            switch (third) {
-#ifdef MSH_CONFIG_HISTORY
-            case 'A':
-                input = MSH_KEYBIND_HISTPREV;
-                break;
-            case 'B':
-                input = MSH_KEYBIND_HISTNEXT;
-                break;
+    switch ( final ) {
+#ifdef MSH_CONFIG_CMDHISTORY
+    case 'A': return MSH_KEYBIND_HISTPREV;
+    case 'B': return MSH_KEYBIND_HISTNEXT;
 #endif
 #ifdef MSH_CONFIG_LINEEDIT
-            case 'C':
-                input = MSH_KEYBIND_CURRIGHT;
-                break;
-            case 'D':
-                input = MSH_KEYBIND_CURLEFT;
-                break;
+    case 'C': return MSH_KEYBIND_CURRIGHT;
+    case 'D': return MSH_KEYBIND_CURLEFT;
+    case 'H': return MSH_KEYBIND_LINEHEAD;
+    case 'F': return MSH_KEYBIND_LINETAIL;
 #endif
-            default:
-                ;
-                /* do nothing */
-            }
-        } else {
-            /* do nothing */
+    case '~':
+        switch ( param ) {
+#ifdef MSH_CONFIG_LINEEDIT
+        case 1: case 7: return MSH_KEYBIND_LINEHEAD;
+        case 4: case 8: return MSH_KEYBIND_LINETAIL;
+#endif
+        case 3:   return MSH_KEYBIND_DELETE;
+        case 200: esc_paste = 1; break;
+        case 201: esc_paste = 0; break;
+        }
+        break;
+    }
+    return ESC_CONSUMED;
+}
+
+/*
+ * Returns 'c' itself if it's not in a sequence, the keybind a complete
+ * sequence maps to, or ESC_CONSUMED.
+ */
+static int
+esc_decode( unsigned char c )
+{
+    unsigned long now = pico_millis();
+
+    if ( now - esc_ms > MSH_ESC_TIMEOUT_MS ) {
+        esc_state = ESC_STATE_NONE;
+        esc_paste = 0; /* lost the end marker, or a paste stalled */
+    }
+    if ( esc_state != ESC_STATE_NONE || esc_paste || c == '\033' ) {
+        esc_ms = now;
+    }
+
+    switch ( esc_state ) {
+    case ESC_STATE_NONE:
+        if ( c == '\033' ) {
+            esc_state = ESC_STATE_ESC;
+            return ESC_CONSUMED;
+        }
+        return c;
+
+    case ESC_STATE_ESC:
+        esc_param = 0;
+        esc_state = ( c == '[' ) ? ESC_STATE_CSI
+                  : ( c == 'O' ) ? ESC_STATE_SS3 : ESC_STATE_NONE;
+        return ESC_CONSUMED; /* ESC and any other char, e.g. Alt-x */
+
+    case ESC_STATE_CSI:
+        if ( c >= '0' && c <= '9' ) {
+            esc_param = ( esc_param > 25 ) ? 255 : esc_param * 10 + (c - '0');
+            return ESC_CONSUMED;
+        }
+        /* fall through */
+    case ESC_STATE_PARAMS:
+        if ( c < 0x40 || c > 0x7E ) {
+            esc_state = ESC_STATE_PARAMS; /* ';', more parameters, '?' etc. */
+            return ESC_CONSUMED;
         }
+        esc_state = ESC_STATE_NONE;
+        return esc_key(c, esc_param);
+
+    case ESC_STATE_SS3:
+    default:
+        esc_state = ESC_STATE_NONE;
+        return esc_key(c, 0);
+    }
+}
+
+static int
+cursor_inputchar( cmdline_t* pcmdline, unsigned char c )
+{
+    int decoded = esc_decode(c);
+    unsigned char input;
+
+    if ( decoded == ESC_CONSUMED ) {
+        return 1;
     }
+    input = decoded;
 
+    /* Pasted text is taken literally: no editing keys, but newlines */
+    if ( esc_paste && decoded == c && iscntrl(c)
+         && c != MSH_KEYBIND_ENTER && c != '\t' ) {
+        return 1;
+    }
 
     switch (input) {
         /*
          * End of input if newline char.
          */
         case MSH_KEYBIND_ENTER:
-            pico_putchar('\n');
+            echo_putchar('\n');
             return 0;
 
         case '\t':
@@ -690,7 +1764,7 @@ cursor_inputchar( cmdline_t* pcmdline, unsigned char c )
 
         case MSH_KEYBIND_DISCARD:
             cmdline_clear(pcmdline);
-            pico_putchar('\n');
+            echo_putchar('\n');
             return 0;
 
         case MSH_KEYBIND_BACKSPACE:
@@ -708,10 +1782,11 @@ cursor_inputchar( cmdline_t* pcmdline, unsigned char c )
 
 #ifdef MSH_CONFIG_LINEEDIT
         case MSH_KEYBIND_CLEAR:
-            cmdline_cursor_linehead(pcmdline);
-            pico_puts(TERMESC_CLEAR);
-            pico_puts(prompt_string);
-            cmdline_cursor_linetail(pcmdline);
+            /* the screen is gone; reprint the whole line */
+            echo_puts(TERMESC_CLEAR);
+            echo_puts(prompt_string);
+            echo_write(pcmdline->buf, pcmdline->linelen);
+            term_cursor_back(pcmdline->linelen - pcmdline->pos);
             break;
 
         case MSH_KEYBIND_CURLEFT:
@@ -794,7 +1869,14 @@ cursor_inputchar( cmdline_t* pcmdline, unsigned char c )
 }
 
 
-int msh_get_cmdline(char* linebuf)
+/*
+ * True while a prompt is displayed and the line is being editted.
+ * False once the line is terminated, until the next line begins.
+ */
+static int bCmdLineActive;
+
+static void
+cmdline_begin( void )
 {
     if ( ! bCmdLineInitialized ) {
         cmdline_init( &CmdLine );
@@ -802,18 +1884,75 @@ int msh_get_cmdline(char* linebuf)
     } else {
         cmdline_clear( &CmdLine );
     }
-    pico_puts(prompt_string);
+    echo_puts(prompt_string);
+    bCmdLineActive = 1; /* true */
+}
 
-    while ( cursor_inputchar( &CmdLine, pico_getchar() ) )
-        ;
+
+int msh_feed_char(int c)
+{
+    if ( ! bCmdLineActive ) {
+        cmdline_begin();
+    }
+
+    if ( cursor_inputchar( &CmdLine, c ) ) {
+        return -1; /* line continues */
+    }
+    bCmdLineActive = 0; /* false */
+    MSH_STAT_INC(lines);
 
 #ifdef MSH_CONFIG_CMDHISTORY
     history_append(CmdLine.buf);
     histnum = 0; /* reset active histnum */
 #endif
 
+    return CmdLine.linelen;
+}
+
+
+int msh_poll(void)
+{
+    int c;
+
+    if ( ! bCmdLineActive ) {
+        cmdline_begin();
+    }
+
+    while ( (c = pico_trygetchar()) >= 0 ) {
+        int len = msh_feed_char(c);
+        if ( len >= 0 ) {
+            return len;
+        }
+    }
+    return -1;
+}
+
+
+char* msh_get_line(void)
+{
+    return CmdLine.buf;
+}
+
+
+int msh_line_active(void)
+{
+    return bCmdLineActive;
+}
+
+
+int msh_get_cmdline(char* linebuf)
+{
+    int len;
+
+    if ( ! bCmdLineActive ) {
+        cmdline_begin();
+    }
+
+    while ( (len = msh_feed_char( pico_getchar() )) < 0 )
+        ;
+
     strcpy(linebuf, CmdLine.buf);
-    return ( strlen( CmdLine.buf ) );
+    return len;
 }
 
 
@@ -835,211 +1974,245 @@ int main(void)
 
 #include "picoshell_config.h"
 
-typedef struct parse_state_struct {
-    const char* readpos;
-    char*       writepos;
-} parse_state_t;
+#include "picoshell_pgmspace.h"
+
+/*
+ * The parser is a state machine, which reads the line in one pass.
+ * Each input char is first mapped to its class by msh_char_class[], and
+ * then (state, class) to the actions and the next state by parse_trans[].
+ * Both tables are in flash.
+ */
+enum {
+    CC_END,     /* '\0' */
+    CC_FS,      /* ' ' */
+    CC_SPACE,   /* other blanks: \t \n \v \f \r */
+    CC_SEP,     /* ';' */
+    CC_SQUOTE,
+    CC_DQUOTE,
+    CC_ESCAPE,
+    CC_PRINT,   /* other printable chars */
+    CC_CTRL,    /* control chars and non-ASCII */
+    CC_COUNT
+};
+
+constexpr unsigned char msh_char_class_of(unsigned c) {
+    return ( c == '\0' )                ? CC_END
+         : ( c == MSH_CMD_FS_CHAR )     ? CC_FS
+         : ( c == MSH_CMD_SEP_CHAR )    ? CC_SEP
+         : ( c == MSH_CMD_SQUOTE_CHAR ) ? CC_SQUOTE
+         : ( c == MSH_CMD_DQUOTE_CHAR ) ? CC_DQUOTE
+         : ( c == MSH_CMD_ESCAPE_CHAR ) ? CC_ESCAPE
+         : ( c >= '\t' && c <= '\r' )   ? CC_SPACE
+         : ( c >= 0x20 && c < 0x7F )    ? CC_PRINT
+         :                                CC_CTRL;
+}
+#define CC4(c)   msh_char_class_of(c), msh_char_class_of(c + 1), \
+                 msh_char_class_of(c + 2), msh_char_class_of(c + 3)
+#define CC16(c)  CC4(c), CC4(c + 4), CC4(c + 8), CC4(c + 12)
+#define CC64(c)  CC16(c), CC16(c + 16), CC16(c + 32), CC16(c + 48)
+
+static const unsigned char msh_char_class[256] PROGMEM = {
+    CC64(0), CC64(64), CC64(128), CC64(192)
+};
+
+/* states; the low 4 bits of parse_trans[] */
+enum {
+    PS_BLANK,   /* between arguments */
+    PS_WORD,    /* in an argument */
+    PS_SQUOTE,  /* in '...' */
+    PS_DQUOTE,  /* in "..." */
+    PS_ESCAPE,  /* after a backslash */
+    PS_COUNT,
+    PS_ERROR = 0x0F
+};
+#define PS_STATE_MASK  0x0F
+
+/* actions; the high 4 bits of parse_trans[] */
+#define PA_START  0x10  /* an argument starts */
+#define PA_EMIT   0x20  /* copy the char to the argument */
+#define PA_END    0x40  /* the argument ends */
+#define PA_STOP   0x80  /* the command ends (or an error) */
 
+#define PT_ERROR  (PA_STOP | PS_ERROR)
 
 /*
- * E<0 : Syntax error type E (FIXME: no error types defined)
- *   0 : No characters to read (';' or '\0')
- * N>1 : read N chars
- *
- * If error is returned, state of parse_state_t may not be consistent
- * and should never re-used. (whole input line should be discarded.)
+ * A quoted string is taken as it is, up to the closing quote; FIXME: for
+ * now, "..." is the same as '...'. Only printable chars can be escaped.
  */
-static int
-read_token( parse_state_t*  pstate )
-{
-    int   readcount  = 0; /* FIXME counting is not correct */
-    bool  is_squoted = false;
-    bool  is_dquoted = false;
+static const unsigned char parse_trans[PS_COUNT][CC_COUNT] PROGMEM = {
+    /* PS_BLANK */ {
+        /* CC_END    */ PA_STOP,
+        /* CC_FS     */ PS_BLANK,
+        /* CC_SPACE  */ PS_BLANK,
+        /* CC_SEP    */ PA_STOP,
+        /* CC_SQUOTE */ PA_START | PS_SQUOTE,
+        /* CC_DQUOTE */ PA_START | PS_DQUOTE,
+        /* CC_ESCAPE */ PA_START | PS_ESCAPE,
+        /* CC_PRINT  */ PA_START | PA_EMIT | PS_WORD,
+        /* CC_CTRL   */ PT_ERROR,
+    },
+    /* PS_WORD */ {
+        /* CC_END    */ PA_END | PA_STOP,
+        /* CC_FS     */ PA_END | PS_BLANK,
+        /* CC_SPACE  */ PA_END | PS_BLANK,
+        /* CC_SEP    */ PA_END | PA_STOP,
+        /* CC_SQUOTE */ PS_SQUOTE,
+        /* CC_DQUOTE */ PS_DQUOTE,
+        /* CC_ESCAPE */ PS_ESCAPE,
+        /* CC_PRINT  */ PA_EMIT | PS_WORD,
+        /* CC_CTRL   */ PT_ERROR,
+    },
+    /* PS_SQUOTE */ {
+        /* CC_END    */ PT_ERROR, /* no closing quote */
+        /* CC_FS     */ PA_EMIT | PS_SQUOTE,
+        /* CC_SPACE  */ PA_EMIT | PS_SQUOTE,
+        /* CC_SEP    */ PA_EMIT | PS_SQUOTE,
+        /* CC_SQUOTE */ PS_WORD,
+        /* CC_DQUOTE */ PA_EMIT | PS_SQUOTE,
+        /* CC_ESCAPE */ PA_EMIT | PS_SQUOTE,
+        /* CC_PRINT  */ PA_EMIT | PS_SQUOTE,
+        /* CC_CTRL   */ PA_EMIT | PS_SQUOTE,
+    },
+    /* PS_DQUOTE */ {
+        /* CC_END    */ PT_ERROR, /* no closing quote */
+        /* CC_FS     */ PA_EMIT | PS_DQUOTE,
+        /* CC_SPACE  */ PA_EMIT | PS_DQUOTE,
+        /* CC_SEP    */ PA_EMIT | PS_DQUOTE,
+        /* CC_SQUOTE */ PA_EMIT | PS_DQUOTE,
+        /* CC_DQUOTE */ PS_WORD,
+        /* CC_ESCAPE */ PA_EMIT | PS_DQUOTE,
+        /* CC_PRINT  */ PA_EMIT | PS_DQUOTE,
+        /* CC_CTRL   */ PA_EMIT | PS_DQUOTE,
+    },
+    /* PS_ESCAPE */ {
+        /* CC_END    */ PT_ERROR,
+        /* CC_FS     */ PA_EMIT | PS_WORD,
+        /* CC_SPACE  */ PT_ERROR,
+        /* CC_SEP    */ PA_EMIT | PS_WORD,
+        /* CC_SQUOTE */ PA_EMIT | PS_WORD,
+        /* CC_DQUOTE */ PA_EMIT | PS_WORD,
+        /* CC_ESCAPE */ PA_EMIT | PS_WORD,
+        /* CC_PRINT  */ PA_EMIT | PS_WORD,
+        /* CC_CTRL   */ PT_ERROR,
+    },
+};
 
-    while ( 1 ) {
-        char ch = *pstate->readpos;
 
-        if ( ch == '\0' ) {
-            break; /* end of input */
-        }
-        readcount++;
+/*
+ * Parse one command of 'cmdline' into argv[], copying the arguments to
+ * 'argvbuf'. 'argvbuf' may be 'cmdline' itself, to tokenize it in place:
+ * the write position never goes ahead of the read position, since an
+ * argument is never longer than its input (quotes and escapes are only
+ * removed), and each char is classified before it may be overwritten.
+ */
+static const char*
+parse_line(const char* cmdline, char* argvbuf, int* pargc, char** argv)
+{
+    const char* readpos  = cmdline;
+    char*       writepos = argvbuf;
+    unsigned char state  = PS_BLANK;
+    int argc = 0;
 
-        /*
-         * We are in quote
-         */
-        if ( is_squoted || is_dquoted ) {
-            if (   (is_squoted  &&  ch == '\'')
-                || (is_dquoted  &&  ch == '"' )  )  {
-                /*
-                 * FIXME : For now, we treat dquote as squote.
-                 */
-                /* Closing quote */
-                is_squoted = false;
-                is_dquoted = false;
-            } else {
-                /* Read the char as it is. */
-                *pstate->writepos++ = ch;
-            }
-        }
-        /*
-         * We are NOT in quote
-         */
-        else
-        {
-            /* quote */
-            if ( ch == '\'' ) {
-                is_squoted = true;
-            }
-            else
-            if ( ch == '"' ) {
-                is_dquoted = true;
-            }
+    argv[0] = argvbuf;
 
-            /* Backslash (Escaping): read a char ahead */
-            else
-            if ( ch == MSH_CMD_ESCAPE_CHAR ) {
-                /* read a char ahead */
-                pstate->readpos++;
-                ch = *pstate->readpos;
-                if ( ! isprint((unsigned)ch) ) {
-                    /* You can only escape normal chars */
-                    return -1;
-                } else {
-                    readcount++;
-                    *pstate->writepos++ = ch;
-                }
-            }
+    while ( 1 ) {
+        unsigned char c  = *readpos;
+        unsigned char cc = pgm_read_byte(&msh_char_class[c]);
+        unsigned char t  = pgm_read_byte(&parse_trans[state][cc]);
 
-            /* A blank not in quote or not escaped, or a
-             * command line separator (';') makes this argument done. */
-            else
-            if ( isspace((unsigned)ch)
-                 || ch == MSH_CMD_SEP_CHAR )  {
-                readcount--;
-                break; /* end of current argument */
+        if ( t & PA_START ) {
+            if ( argc >= MSH_CMDARGS_MAX ) {
+                return NULL; /* Too many arguments */
             }
-
-            /* Normal chars */
-            else
-            if ( isprint((unsigned)ch) ) {
-                *pstate->writepos++ = ch;
+            argv[argc] = writepos;
+        }
+        if ( t & PA_EMIT ) {
+            *writepos++ = c;
+        }
+        if ( t & PA_END ) {
+            *writepos++ = '\0';
+            argc++;
+        }
+        if ( t & PA_STOP ) {
+            *pargc = argc;
+            if ( argc == 0 ) {
+                *writepos = '\0'; /* argv[0] is "" for an empty command */
             }
-
-            /* NON Printable (control code) char  */
-            else
-            {
-                /*
-                 * If you want to just Ignore invalid characters,
-                 * comment-out the blow.
-                 */
-                return -1; /* Syntax error */
+            if ( (t & PS_STATE_MASK) == PS_ERROR ) {
+                return NULL; /* Syntax error */
             }
+            /* Tell the caller where to restart after ';' */
+            return ( cc == CC_SEP ) ? readpos + 1 : cmdline;
         }
-        pstate->readpos++;
+        state = t & PS_STATE_MASK;
+        readpos++;
     }
+}
 
-    /*
-     * Finally, check if state is consistent,
-     * I.e., check for no-closing quote etc.
-     */
-    if ( is_squoted || is_dquoted ) {
-        return -1; /* Syntax error */
-    } else {
-        *pstate->writepos++ = '\0';
-        return readcount;
+/* parse_line(), counted in msh_stats */
+static const char*
+parse_command(const char* cmdline, char* argvbuf, int* pargc, char** argv)
+{
+    MSH_STAT_TIMER(t0);
+    const char* ret = parse_line(cmdline, argvbuf, pargc, argv);
+    MSH_STAT_ELAPSED(parse_us, t0);
+    MSH_STAT_INC(commands);
+    if ( ret == NULL ) {
+        MSH_STAT_INC(syntax_errors);
     }
+    return ret;
 }
 
 const char*
 msh_parse_line(const char* cmdline, char* argvbuf, int* pargc, char** argv)
 {
-    /*
-     * Prepare and initialize a parse_state_t.
-     */
-    parse_state_t state;
-    state.readpos  = cmdline;
-    state.writepos = argvbuf;
-
-    *pargc = 0;
-    argv[0] = argvbuf;
-
-    while ( *state.readpos != '\0' ) {
-
-        /*
-         * Skip preceeding spaces or ';'
-         */
-        while ( isspace((unsigned)*state.readpos) ) {
-            state.readpos++;
-        }
+    return parse_command(cmdline, argvbuf, pargc, argv);
+}
 
-        int ret = read_token( &state );
+char*
+msh_parse_line_inplace(char* cmdline, int* pargc, char** argv)
+{
+    return (char*)parse_command(cmdline, cmdline, pargc, argv);
+}
 
-        /*
-         * Syntax error
-         */
-        if ( ret < 0 ) {
-            return NULL;
-        }
-        else
-        /*
-         * No more chars to read. Case I
-         */
-        if ( ret == 0 ) {
-            switch ( *(state.readpos) ) {
-                case '\0':
-                    return cmdline;
-                case MSH_CMD_SEP_CHAR:
-                    return (state.readpos+1);
-                default:
-                    pico_puts("Fatal error in parse() \n");
-                    return NULL;
-            }
-        }
 
-        /*
-         * Normal
-         */
-        else
-        {
-            (*pargc)++;
-            char stopchar = *(state.readpos);
-            /*
-             * No more chars to read. Case II
-             */
-            if ( stopchar == '\0' ) {
-                return cmdline;
-            }
+/* ***************************************************************************
+ *                           the static buffers
+ * ***************************************************************************/
+typedef struct {
+    const char*    name;
+    unsigned short size;
+} buffer_entry;
 
-            /*
-             * End of command by ';'.
-             * Tell the caller where to restart.
-             */
-            if ( stopchar == MSH_CMD_SEP_CHAR ) {
-                state.readpos++;/* skip ';' */
-                return (state.readpos);
-            }
+static const char buffer_cmdline_name[]  PROGMEM = "line editor";
+#ifdef MSH_CONFIG_CMDHISTORY
+static const char buffer_history_name[]  PROGMEM = "history";
+static const char buffer_curline_name[]  PROGMEM = "history edit";
+#endif
+static const char buffer_registry_name[] PROGMEM = "registry";
+#ifdef MSH_CONFIG_STATS
+static const char buffer_stats_name[]    PROGMEM = "stats";
+#endif
 
-            /*
-             * read_token() stoped by a argument separator.
-             */
-            else
-            if ( isspace((unsigned)stopchar) ) {
-                argv[*pargc] = state.writepos;
-                continue;
-            }
+static const buffer_entry buffers[] PROGMEM = {
+    { buffer_cmdline_name,  sizeof(CmdLine) },
+#ifdef MSH_CONFIG_CMDHISTORY
+    { buffer_history_name,  sizeof(history) },
+    { buffer_curline_name,  sizeof(curline) },
+#endif
+    { buffer_registry_name, sizeof(registry) },
+#ifdef MSH_CONFIG_STATS
+    { buffer_stats_name,    sizeof(msh_stats) + sizeof(command_stats) },
+#endif
+};
 
-            /*
-             * Can't be!!
-             */
-            else {
-                pico_puts("Fatal error in parse() ");
-                return NULL;
-            }
-        }
+const char* msh_get_buffer(int i, unsigned int* size)
+{
+    if ( i < 0 || i >= (int)(sizeof(buffers) / sizeof(buffers[0])) ) {
+        return NULL;
     }
-
-    /* Tell the caller that whole line has processed */
-    return cmdline;
+    *size = pgm_read_word(&buffers[i].size);
+    return (const char*)pgm_read_ptr(&buffers[i].name);
 }
 
 
@@ -1,7 +1,9 @@
 #ifndef __MSH_H_INCLUDED__
 #define __MSH_H_INCLUDED__
 
+#include <stdint.h>
 #include "picoshell_config.h"
+#include "picoshell_pgmspace.h"
 
 
 /* ********************************************************************
@@ -10,6 +12,22 @@
 void msh_set_prompt(char* str);
 
 
+/* ********************************************************************
+ * Select how the line editor redraws the line: with VT100 cursor control
+ * sequences (enable != 0), or with backspaces only for dumb terminals.
+ * The default is on if MSH_CONFIG_VT100 is defined.
+ */
+void msh_set_vt100(int enable);
+int  msh_get_vt100(void);
+
+
+/* ********************************************************************
+ * Turn off (enable == 0) or on all output of the line editor: echo back
+ * of input chars, redraws, bell and the prompt. Editting keys still work.
+ */
+void msh_set_echo(int enable);
+
+
 /* ********************************************************************
  * Read user input by getchar(), with Emacs-like line editting.
  * Once input of a command line finished, msh_get_cmdline() copies
@@ -21,6 +39,33 @@ void msh_set_prompt(char* str);
 int msh_get_cmdline(char* cmdline);
 
 
+/* ********************************************************************
+ * Non-blocking counterparts of msh_get_cmdline().
+ *
+ * msh_feed_char() gives one input char to the line editor.
+ * msh_poll() feeds all chars pico_trygetchar() has ready, and returns
+ * as soon as a line is complete or no more input is available.
+ *
+ * Both return -1 while the line is still being editted, or the length
+ * of the line when it is complete. The completed line is available by
+ * msh_get_line() until next char is fed. The prompt is printed when
+ * the next line begins.
+ *
+ *     if ( msh_poll() > 0 ) {
+ *         run( msh_get_line() );
+ *     }
+ */
+int   msh_feed_char(int c);
+int   msh_poll(void);
+char* msh_get_line(void);
+
+/*
+ * True once the prompt of the next line is printed, i.e. the output of
+ * the last line has been all handed to pico_putchar().
+ */
+int   msh_line_active(void);
+
+
 
 
 /* ********************************************************************
@@ -37,12 +82,72 @@ int msh_get_cmdline(char* cmdline);
 const char*
 msh_parse_line(const char* cmdline, char* argvbuf, int* pargc, char** pargv);
 
+/*
+ * Same as msh_parse_line(), but without argvbuf: 'cmdline' itself is
+ * terminated and unescaped in place, and argv[] points into it.
+ * The part of 'cmdline' after the returned pointer is left intact,
+ * so the rest of ';' separated commands can be parsed in turn.
+ *
+ *     char* linebufp = msh_get_line();
+ *     char* ret = msh_parse_line_inplace(linebufp, &argc, argv);
+ */
+char*
+msh_parse_line_inplace(char* cmdline, int* pargc, char** pargv);
+
 
 
 
 /* ********************************************************************
+ * A command table is an array of msh_command_entry in flash (PROGMEM),
+ * and so are all the strings it points to; none of them takes RAM.
+ * Use the macros below to define one:
+ *
+ *     msh_declare_command( rgb );
+ *     const msh_command_entry my_commands[] PROGMEM = {
+ *         msh_define_command( rgb ),
+ *         MSH_COMMAND_TERMINATOR
+ *     };
+ *     msh_define_help( rgb, "set the color", "Usage: rgb R G B\n" );
+ *     int cmd_rgb(int argc, const char** argv) { ... }
+ *
+ * A typed command instead has a schema of its arguments, and its handler
+ * is given them checked and converted, in msh_args:
+ *
+ *     msh_declare_typed_command( fade, "bbb?w[0-9999]" );
+ *         msh_define_typed_command( fade ),
+ *     int cmd_fade(const msh_args* args) { ... args->v[3].u16 ... }
  *
+ * A schema is a list of the types of the arguments in order:
+ *     b        u8, 0 to 255
+ *     w        u16, 0 to 65535
+ *     l        u32
+ *     x        a color in hex, rrggbb, into rgb[]
+ *     9        a color as 3 digits of 0-9, e.g. 950, scaled into rgb[]
+ *     (a|b|c)  one of the words, into u8 as its index from 0
+ *     s        any string, into str
+ * A number type may be followed by a range "[min-max]". The arguments
+ * after a '?' are optional, and '*' after a type repeats it any times.
+ * '|' separates alternative forms of the arguments; the first form which
+ * matches is taken, and its index is set to 'form'. For example:
+ *     "bbb|9|x"           rgb 255 0 0, rgb 900, or rgb ff0000
+ *     "|(ok)|l?(save)"    baud, baud ok, baud 9600, or baud 9600 save
+ * If no form matches, the handler is not called, and the command fails
+ * with an error message and a return code of 1.
  */
+typedef union {
+    uint8_t     u8;
+    uint16_t    u16;
+    uint32_t    u32;
+    uint8_t     rgb[3];
+    const char* str;
+} msh_value;
+
+typedef struct {
+    uint8_t   form;    /* which of the '|' separated forms, from 0 */
+    uint8_t   count;   /* the number of values */
+    msh_value v[MSH_CMDARGS_MAX - 1];
+} msh_args;
+
 typedef struct
 {
     const char *  name;
@@ -51,36 +156,181 @@ typedef struct
     const char *  description;
     const char *  usage;
 #endif
+    int           (*typed)(const msh_args* args);  /* if func is NULL */
+    const char *  schema;
 } msh_command_entry;
 
 #ifdef MSH_CONFIG_HELP
 
 #    define msh_declare_command(name) \
             int cmd_##name(int argc, const char** argv);\
-            extern const char cmd_##name##_desc[]; \
-            extern const char cmd_##name##_usage[];
+            static const char cmd_##name##_name[] PROGMEM = #name; \
+            extern const char cmd_##name##_desc[] PROGMEM; \
+            extern const char cmd_##name##_usage[] PROGMEM;
+#    define msh_declare_typed_command(name, schema) \
+            int cmd_##name(const msh_args* args);\
+            static const char cmd_##name##_name[] PROGMEM = #name; \
+            static const char cmd_##name##_schema[] PROGMEM = schema; \
+            extern const char cmd_##name##_desc[] PROGMEM; \
+            extern const char cmd_##name##_usage[] PROGMEM;
 #    define msh_define_help( name, desc, usage ) \
-            const char cmd_##name##_desc[] = desc; \
-            const char cmd_##name##_usage[] = usage;
+            const char cmd_##name##_desc[] PROGMEM = desc; \
+            const char cmd_##name##_usage[] PROGMEM = usage;
 #    define msh_define_command(name) \
-            {#name, cmd_##name, cmd_##name##_desc, cmd_##name##_usage}
-#    define MSH_COMMAND_TERMINATOR  {0, 0, 0, 0}
+            {cmd_##name##_name, cmd_##name, cmd_##name##_desc, cmd_##name##_usage, 0, 0}
+#    define msh_define_typed_command(name) \
+            {cmd_##name##_name, 0, cmd_##name##_desc, cmd_##name##_usage, \
+             cmd_##name, cmd_##name##_schema}
+#    define MSH_COMMAND_TERMINATOR  {0, 0, 0, 0, 0, 0}
 
 #else /* MSH_CONFIG_HELP */
 
 #    define msh_declare_command(name) \
-            int cmd_##name(int argc, const char** argv);
+            int cmd_##name(int argc, const char** argv);\
+            static const char cmd_##name##_name[] PROGMEM = #name;
+#    define msh_declare_typed_command(name, schema) \
+            int cmd_##name(const msh_args* args);\
+            static const char cmd_##name##_name[] PROGMEM = #name; \
+            static const char cmd_##name##_schema[] PROGMEM = schema;
 #    define msh_define_help( name, desc, usage ) /* vanish */
-#    define msh_define_command(name) {#name, cmd_##name}
-#    define MSH_COMMAND_TERMINATOR  {0, 0}
+#    define msh_define_command(name) {cmd_##name##_name, cmd_##name, 0, 0}
+#    define msh_define_typed_command(name) \
+            {cmd_##name##_name, 0, cmd_##name, cmd_##name##_schema}
+#    define MSH_COMMAND_TERMINATOR  {0, 0, 0, 0}
 
 #endif /* MSH_CONFIG_HELP */
 
 
+/*
+ * Print a string in flash, such as the usage from msh_get_usage(), or a
+ * literal in PSTR("...").
+ */
+void msh_puts_P(const char* s);
+
+
 extern const msh_command_entry msh_builtin_commands[];
+
+/* the number of commands in msh_builtin_commands[], for compile time checks
+ * against MSH_COMMANDS_MAX: echo, term, and shellhelp and stats if enabled */
+#if defined(MSH_CONFIG_HELP_KEYBIND) && defined(MSH_CONFIG_STATS)
+#    define MSH_BUILTIN_COMMANDS_COUNT  4
+#elif defined(MSH_CONFIG_HELP_KEYBIND) || defined(MSH_CONFIG_STATS)
+#    define MSH_BUILTIN_COMMANDS_COUNT  3
+#else
+#    define MSH_BUILTIN_COMMANDS_COUNT  2
+#endif
 int msh_do_command(const msh_command_entry* cmdp, int argc, const char** argv);
 
 void msh_print_cmdlist(const msh_command_entry* cmdlist);
 const char* msh_get_command_usage(const msh_command_entry* cmdlist, const char* cmdname);
 
+
+/* ********************************************************************
+ * The command registry: all command tables merged and sorted by name,
+ * so that a command is found by one binary search.
+ *
+ * msh_register_commands() adds a table to the registry. If a name is
+ * already registered, the earlier one is kept; so register your own
+ * tables before msh_builtin_commands to override a builtin.
+ * Returns -1 if the registry is full (see MSH_COMMANDS_MAX).
+ *
+ * msh_exec_command() executes argv[0] found in the registry, and returns
+ * its return value, or -1 if no such command is registered.
+ *
+ *     msh_register_commands(my_commands);
+ *     msh_register_commands(msh_builtin_commands);
+ *     ...
+ *     if ( msh_exec_command(argc, argv) < 0 ) { not found }
+ */
+int   msh_register_commands(const msh_command_entry* cmdlist);
+const msh_command_entry* msh_find_command(const char* name);
+int   msh_exec_command(int argc, const char** argv);
+void  msh_print_commands(void);
+
+/*
+ * To look a command up once and run it later, e.g. from a queue:
+ * msh_command_index() returns the index of 'name' in the registry, or -1,
+ * and msh_exec_index() runs the command at 'index' as msh_exec_command()
+ * does. msh_command_name() returns the name (in flash) at 'index', or
+ * NULL past the last. An index stays valid until another table is
+ * registered.
+ */
+int   msh_command_index(const char* name);
+const char* msh_command_name(int index);
+int   msh_exec_index(int index, int argc, const char** argv);
+
+/*
+ * To run a typed command many times with the same arguments, e.g. from a
+ * macro: msh_pack_args() converts argv[] once, by the schema of the
+ * command at 'index', into 'buf' of 'size' bytes, and returns the bytes
+ * used; 0 if the command is not typed (keep argv[] then), -1 if the
+ * arguments don't fit the schema, with the error printed, or -2 if
+ * 'buf' is too small. msh_exec_packed() runs the command with them, as
+ * msh_exec_index() does, and msh_print_packed() prints them back as
+ * arguments, each after a blank. msh_command_schema() returns the schema
+ * (in flash) at 'index', or NULL if it's not typed; packed arguments are
+ * valid only while it's the same.
+ */
+int   msh_pack_args(int index, int argc, const char** argv, uint8_t* buf, int size);
+int   msh_exec_packed(int index, const uint8_t* buf);
+void  msh_print_packed(int index, const uint8_t* buf);
+const char* msh_command_schema(int index);
+
+/*
+ * The usage text of a command, in flash (print it with msh_puts_P()),
+ * or NULL if no such command.
+ */
+const char* msh_get_usage(const char* cmdname);
+
+
+/* ********************************************************************
+ * The static buffers of picoshell: msh_get_buffer() returns the name (in
+ * flash) of the i-th one from 0 and sets its size in bytes, or returns
+ * NULL past the last. For tuning MSH_CMDLINE_CHAR_MAX etc. to the RAM.
+ *
+ *     for ( i = 0;  (name = msh_get_buffer(i, &size)) != NULL;  i++ )
+ */
+const char* msh_get_buffer(int i, unsigned int* size);
+
+
+/* ********************************************************************
+ * Performance counters, with MSH_CONFIG_STATS. The line editor, the
+ * parser and the registry count into msh_stats, and so do the I/O
+ * routines (pico_*()) with MSH_STAT_*(), which vanish without
+ * MSH_CONFIG_STATS. The 'stats' builtin prints them, with the calls and
+ * the longest run of each registered command; 'stats reset' clears all.
+ *
+ *     MSH_STAT_TIMER(t0);
+ *     Serial.write(buf, len);
+ *     MSH_STAT_ELAPSED(write_us, t0);
+ *     MSH_STAT_ADD(bytes_out, len);
+ */
+#ifdef MSH_CONFIG_STATS
+typedef struct {
+    unsigned long bytes_in;      /* read from the port */
+    unsigned long bytes_out;     /* written to the port */
+    unsigned long writes;        /* write calls to the port */
+    unsigned long write_us;      /* time blocked in them */
+    unsigned long xoff;          /* XOFFs sent */
+    unsigned long rx_full;       /* RX buffer found full; input may be lost */
+    unsigned long lines;         /* lines completed in the line editor */
+    unsigned long commands;      /* commands parsed; more than one per ';' */
+    unsigned long syntax_errors;
+    unsigned long parse_us;      /* time in msh_parse_line*() */
+    unsigned long dispatch_us;   /* time in msh_exec/do_command() */
+} msh_stats_t;
+
+extern msh_stats_t msh_stats;
+
+#    define MSH_STAT_INC(field)         (msh_stats.field++)
+#    define MSH_STAT_ADD(field, n)      (msh_stats.field += (n))
+#    define MSH_STAT_TIMER(t)           unsigned long t = pico_micros()
+#    define MSH_STAT_ELAPSED(field, t)  (msh_stats.field += pico_micros() - (t))
+#else
+#    define MSH_STAT_INC(field)         ((void)0)
+#    define MSH_STAT_ADD(field, n)      ((void)0)
+#    define MSH_STAT_TIMER(t)           ((void)0)
+#    define MSH_STAT_ELAPSED(field, t)  ((void)0)
+#endif
+
 #endif/*__MSH_H_INCLUDED__*/
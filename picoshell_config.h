@@ -2,8 +2,13 @@
 #define __MSH_SHELL_CONFIG_H_INCLUDED__
 
 int pico_getchar(void);
+int pico_trygetchar(void); /* non-blocking; returns -1 if no input */
 int pico_putchar(int c);
 int pico_puts(const char* s);
+int pico_write(const char* buf, int len);
+void pico_flush(void); /* send out buffered output */
+unsigned long pico_millis(void); /* for MSH_ESC_TIMEOUT_MS */
+unsigned long pico_micros(void); /* for MSH_CONFIG_STATS */
 
 #ifndef NULL
 #define NULL ((void *) 0)
@@ -14,10 +19,12 @@ int pico_puts(const char* s);
  * ************************************************************************* */
 
 #define MSH_CONFIG_HELP         /* Enable help */
-//#define MSH_CONFIG_HELP_KEYBIND /* Enable keybind help */
+#define MSH_CONFIG_HELP_KEYBIND /* Enable keybind help */
 #define MSH_CONFIG_LINEEDIT     /* Enable command line editor */
 //#define MSH_CONFIG_CLIPBOARD    /* Enable command line cut & paste; depends on LINEEDIT */
 #define MSH_CONFIG_CMDHISTORY   /* Enable command line history */
+#define MSH_CONFIG_VT100        /* Assume a VT100 terminal by default (see 'term') */
+#define MSH_CONFIG_STATS        /* Count bytes, lines, time etc. (see 'stats') */
 
 
 
@@ -30,9 +37,18 @@ int pico_puts(const char* s);
 /* maximum argument a commandline can hold, i.e., max of argc value */
 #define MSH_CMDARGS_MAX (8)
 
-/* maximum number of history */
+/* maximum number of commands in the registry (all tables together); each
+ * takes a pointer, and an int and a long more with MSH_CONFIG_STATS */
+#define MSH_COMMANDS_MAX (32)
+
+/* memory for history, in number of MSH_CMDLINE_CHAR_MAX long lines.
+ * Lines are packed, so shorter lines make more history. */
 #define MSH_CMD_HISTORY_MAX  (4)
 
+/* drop an escape sequence from the terminal (e.g. a lone ESC) if its
+ * next char doesn't come in this time */
+#define MSH_ESC_TIMEOUT_MS   (100)
+
 /* ring the terminal bell (\a) if invalid keyinput */
 #define MSH_CONFIG_ENABLE_BELL
 
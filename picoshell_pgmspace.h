@@ -0,0 +1,37 @@
+#ifndef __MSH_PGMSPACE_H_INCLUDED__
+#define __MSH_PGMSPACE_H_INCLUDED__
+
+/*
+ * Tables and strings in flash (PROGMEM) on AVR. Elsewhere, flash and RAM
+ * share one address space and these are plain memory accesses.
+ */
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(p)   ((void*)pgm_read_word(p))
+#endif
+#else
+#include <string.h>
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef PSTR
+#define PSTR(s)           (s)
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(p)  (*(const unsigned char*)(p))
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(p)  (*(const unsigned short*)(p))
+#endif
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(p)   (*(void* const*)(p))
+#endif
+#ifndef strcmp_P
+#define strcmp_P(s, p)          strcmp((s), (p))
+#define strlen_P(p)             strlen(p)
+#define strncpy_P(d, p, n)      strncpy((d), (p), (n))
+#endif
+#endif
+
+#endif/*__MSH_PGMSPACE_H_INCLUDED__*/
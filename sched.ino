@@ -0,0 +1,238 @@
+/*
+ * Commands scheduled to run at a given millis(), for 'at' and 'after'.
+ *
+ * A command is looked up and split into its arguments when it's added,
+ * so sched_tick(), called from loop(), only has to copy the arguments
+ * out and call it when it's due. Pending commands are kept in a binary
+ * min-heap on (due, seq): the next one is always at heap[0], and 'seq'
+ * keeps commands due at the same ms in the order they were added. Their
+ * arguments are packed, each followed by a '\0', in pool[], which is
+ * compacted when a command is taken out.
+ *
+ * Scheduled commands run with the output muted, as there's no one to
+ * read it; their return codes are only counted.
+ */
+#include <stdint.h>
+#include "picoshell.h"
+#include "brink.h"
+
+#ifndef SCHED_MAX
+#define SCHED_MAX         12   /* commands pending at once */
+#endif
+#ifndef SCHED_POOL_BYTES
+#define SCHED_POOL_BYTES  128  /* for their arguments */
+#endif
+#if SCHED_POOL_BYTES > 255
+#error "offsets in the pool are 8-bit"
+#endif
+
+typedef struct {
+    unsigned long due;    /* millis() */
+    uint16_t seq;
+    uint8_t  index;       /* of the command in the registry */
+    uint8_t  argc;
+    uint8_t  args;        /* offset in pool[] */
+    uint8_t  len;         /* bytes in pool[] */
+} sched_entry_t;
+
+static struct {
+    sched_entry_t heap[SCHED_MAX];
+    uint8_t  count;
+    uint8_t  pool_used;
+    uint16_t seq;
+    unsigned long zero;   /* millis() at time 0 of 'at' */
+    sched_info_t info;
+    char pool[SCHED_POOL_BYTES];
+} sched;
+
+
+/* Does 'a' run before 'b'? Both wrap around safely. */
+static bool sched_before(const sched_entry_t* a, const sched_entry_t* b)
+{
+    long d = (long)(a->due - b->due);
+    return ( d < 0 || ( d == 0 && (int16_t)(a->seq - b->seq) < 0 ) );
+}
+
+static void sched_swap(uint8_t i, uint8_t j)
+{
+    sched_entry_t t = sched.heap[i];
+    sched.heap[i] = sched.heap[j];
+    sched.heap[j] = t;
+}
+
+static void sched_sift_up(uint8_t i)
+{
+    while ( i > 0 ) {
+        uint8_t parent = (i - 1) / 2;
+        if ( ! sched_before(&sched.heap[i], &sched.heap[parent]) ) {
+            break;
+        }
+        sched_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void sched_sift_down(uint8_t i)
+{
+    while ( 1 ) {
+        uint8_t least = i;
+        uint8_t l = 2 * i + 1;
+        uint8_t r = l + 1;
+        if ( l < sched.count && sched_before(&sched.heap[l], &sched.heap[least]) ) {
+            least = l;
+        }
+        if ( r < sched.count && sched_before(&sched.heap[r], &sched.heap[least]) ) {
+            least = r;
+        }
+        if ( least == i ) {
+            break;
+        }
+        sched_swap(i, least);
+        i = least;
+    }
+}
+
+/* Take the next command out of the heap, and its arguments out of the pool. */
+static void sched_pop(sched_entry_t* e, char* args)
+{
+    *e = sched.heap[0];
+    memcpy(args, &sched.pool[e->args], e->len);
+
+    memmove(&sched.pool[e->args], &sched.pool[e->args + e->len],
+            sched.pool_used - e->args - e->len);
+    sched.pool_used -= e->len;
+    for ( uint8_t i = 1;  i < sched.count;  i++ ) {
+        if ( sched.heap[i].args > e->args ) {
+            sched.heap[i].args -= e->len;
+        }
+    }
+    sched.heap[0] = sched.heap[--sched.count];
+    sched_sift_down(0);
+}
+
+
+/*
+ * Schedule argv[] (argv[0] being the command at 'index' of the registry,
+ * see msh_command_index()) to run when millis() reaches 'due'.
+ * Returns false if there's no room left for it.
+ */
+bool sched_add(unsigned long due, int index, int argc, const char** argv)
+{
+    unsigned int len = 0;
+
+    for ( int i = 0;  i < argc;  i++ ) {
+        len += strlen(argv[i]) + 1;
+    }
+    if ( sched.count >= SCHED_MAX || len > MSH_CMDLINE_CHAR_MAX
+         || sched.pool_used + len > SCHED_POOL_BYTES ) {
+        sched.info.dropped++;
+        return false;
+    }
+
+    sched_entry_t* e = &sched.heap[sched.count];
+    e->due   = due;
+    e->seq   = sched.seq++;
+    e->index = index;
+    e->argc  = argc;
+    e->args  = sched.pool_used;
+    e->len   = len;
+    for ( int i = 0;  i < argc;  i++ ) {
+        strcpy(&sched.pool[sched.pool_used], argv[i]);
+        sched.pool_used += strlen(argv[i]) + 1;
+    }
+    sched_sift_up(sched.count++);
+    return true;
+}
+
+/*
+ * Set the time 0 of 'at' to 'ms' from now.
+ */
+void sched_set_zero(unsigned long ms)
+{
+    sched.zero = millis() + ms;
+}
+
+/*
+ * millis() at 'ms' after the time 0.
+ */
+unsigned long sched_at(unsigned long ms)
+{
+    return sched.zero + ms;
+}
+
+/*
+ * Drop all pending commands, and reset the counts.
+ */
+void sched_clear(void)
+{
+    sched.count     = 0;
+    sched.pool_used = 0;
+    memset(&sched.info, 0, sizeof(sched.info));
+}
+
+/*
+ * Run the commands which are due.
+ */
+void sched_tick(void)
+{
+    while ( sched.count > 0 && (long)(millis() - sched.heap[0].due) >= 0 ) {
+        sched_entry_t e;
+        char  args[MSH_CMDLINE_CHAR_MAX];
+        const char* argv[MSH_CMDARGS_MAX];
+
+        /* out of the queue first, as the command may add or clear */
+        sched_pop(&e, args);
+        unsigned long late = millis() - e.due;
+        if ( late > sched.info.late_max_ms ) {
+            sched.info.late_max_ms = late;
+        }
+
+        const char* p = args;
+        for ( uint8_t i = 0;  i < e.argc;  i++ ) {
+            argv[i] = p;
+            p += strlen(p) + 1;
+        }
+        pico_set_mute(true);
+        int rc = msh_exec_index(e.index, e.argc, argv);
+        pico_set_mute(false);
+
+        sched.info.run++;
+        if ( rc != 0 ) {
+            sched.info.failed++;
+        }
+    }
+}
+
+void sched_get_info(sched_info_t* info)
+{
+    *info = sched.info;
+    info->pending   = sched.count;
+    info->capacity  = SCHED_MAX;
+    info->pool_used = sched.pool_used;
+    info->pool_size = SCHED_POOL_BYTES;
+}
+
+/*
+ * The pending commands in the order they run: call with 'prev' NULL for
+ * the first, and then with the last one returned. Returns NULL past the
+ * last. Sets the ms until it's due (negative if overdue) and its args,
+ * packed as in the pool.
+ */
+const void* sched_list(const void* prev, long* in_ms, const char** args, uint8_t* argc)
+{
+    const sched_entry_t* next = NULL;
+
+    for ( uint8_t i = 0;  i < sched.count;  i++ ) {
+        const sched_entry_t* e = &sched.heap[i];
+        if ( ( prev == NULL || sched_before((const sched_entry_t*)prev, e) )
+             && ( next == NULL || sched_before(e, next) ) ) {
+            next = e;
+        }
+    }
+    if ( next ) {
+        *in_ms = (long)(next->due - millis());
+        *args  = &sched.pool[next->args];
+        *argc  = next->argc;
+    }
+    return next;
+}
@@ -11,6 +11,7 @@ void io_close(void);
 
 int pico_putchar(int c);
 int pico_puts(const char* s);
+void pico_flush(void);
 
 
 /* *************************************************************************** *
@@ -39,14 +40,52 @@ int pico_puts(const char* s);
  * Prototypes for our commands
  */
 msh_declare_command( help );
-msh_declare_command( rgb );
+msh_declare_typed_command( rgb, "bbb|9|x" );
+msh_declare_typed_command( bright, "?b" );
+msh_declare_typed_command( fade, "bbb?w" );
+msh_declare_typed_command( blink, "bbb?wb" );
+msh_declare_typed_command( pattern, "(stop|breathe|rainbow|alert)" );
+msh_declare_command( save );
+msh_declare_typed_command( autosave, "?(off|on)" );
+msh_declare_typed_command( baud, "|(ok)|l?(save)" );
+msh_declare_command( mem );
+msh_declare_command( px );
+msh_declare_command( rle );
+msh_declare_command( show );
+msh_declare_typed_command( at, "lss*" );
+msh_declare_typed_command( after, "lss*" );
+msh_declare_typed_command( sched, "|(zero)?l|(clear)" );
+msh_declare_command( def );
+msh_declare_typed_command( stream, "?b[1-250]" );
+msh_declare_typed_command( mode, "?(human|machine)" );
 
-const msh_command_entry my_commands[] = {
+const msh_command_entry my_commands[] PROGMEM = {
     msh_define_command( help ),
-    msh_define_command( rgb ),
+    msh_define_typed_command( rgb ),
+    msh_define_typed_command( bright ),
+    msh_define_typed_command( fade ),
+    msh_define_typed_command( blink ),
+    msh_define_typed_command( pattern ),
+    msh_define_command( save ),
+    msh_define_typed_command( autosave ),
+    msh_define_typed_command( baud ),
+    msh_define_command( mem ),
+    msh_define_command( px ),
+    msh_define_command( rle ),
+    msh_define_command( show ),
+    msh_define_typed_command( at ),
+    msh_define_typed_command( after ),
+    msh_define_typed_command( sched ),
+    msh_define_command( def ),
+    msh_define_typed_command( stream ),
+    msh_define_typed_command( mode ),
     MSH_COMMAND_TERMINATOR
 };
 
+static_assert(sizeof(my_commands) / sizeof(my_commands[0]) - 1
+              + MSH_BUILTIN_COMMANDS_COUNT <= MSH_COMMANDS_MAX,
+              "too many commands for the registry; raise MSH_COMMANDS_MAX");
+
 /*
  * Define some original commands over built-ins
  *     We have to define cmd_help by yourself...
@@ -59,25 +98,19 @@ msh_define_help( help, "display help for available commands",
 int cmd_help(int argc, const char** argv)
 {
     if ( argc == 1) {
-        msh_print_cmdlist(my_commands);
-        msh_print_cmdlist(msh_builtin_commands);
+        msh_print_commands();
     }
     else
     {
-        const char* usage;
-        usage = msh_get_command_usage(my_commands, argv[1]);
-
-        if ( usage == NULL ) {
-            usage = msh_get_command_usage(msh_builtin_commands, argv[1]);
-        }
+        const char* usage = msh_get_usage(argv[1]);
         if ( usage == NULL ) {
-            pico_puts("No such command: '");
+            msh_puts_P(PSTR("No such command: '"));
             pico_puts(argv[1]);
-            pico_puts("'\n");
+            msh_puts_P(PSTR("'\n"));
         }
         else
         {
-            pico_puts(usage);
+            msh_puts_P(usage);
         }
     }
     return 0;
@@ -85,115 +118,723 @@ int cmd_help(int argc, const char** argv)
 
 
 msh_define_help( rgb, "Set RGB LED color / brightness",
-        "Usage: rgb 255 255 255  # 0 to 255 pwm\n"
-        "       rgb 999          # 0-9 exponential scale\n");
-int cmd_rgb(int argc, const char** argv)
+        "Usage: rgb 255 255 255  # 0 to 255, gamma corrected\n"
+        "       rgb 999          # 0-9 scale\n"
+        "       rgb ffffff       # hex\n");
+int cmd_rgb(const msh_args* args)
 {
-    if ( argc == 2 ) {
-        if (strlen(argv[1]) < 3) {
-            pico_puts("Error: need three digits\n");
+    if ( args->form == 0 ) {
+        anim_set(args->v[0].u8, args->v[1].u8, args->v[2].u8);
+    } else {
+        /* led_rgb() does gamma correction, so the 0-9 scale is linear */
+        anim_set(args->v[0].rgb[0], args->v[0].rgb[1], args->v[0].rgb[2]);
+    }
+    return 0;
+}
+
+
+
+msh_define_help( bright, "show or set the overall brightness",
+        "Usage: bright [0-255]\n"
+        "    Scales all colors, before the gamma correction.\n");
+int cmd_bright(const msh_args* args)
+{
+    char buf[4];
+
+    if ( args->count == 1 ) {
+        led_set_brightness(args->v[0].u8);
+        anim_refresh();
+    } else {
+        pico_puts( utoa(led_get_brightness(), buf, 10) );
+        pico_putchar('\n');
+    }
+    return 0;
+}
+
+
+msh_define_help( fade, "fade the LED to a color",
+        "Usage: fade 255 255 255 [ms]  # default 500ms\n"
+        "    Fades queued while another fade is in progress follow it.\n");
+int cmd_fade(const msh_args* args)
+{
+    uint16_t ms = ( args->count == 4 ) ? args->v[3].u16 : 500;
+
+    if ( anim_running() && ! anim_oneshot() ) {
+        anim_stop(); /* a loop never ends, don't queue after it */
+    }
+    if ( ! anim_push(args->v[0].u8, args->v[1].u8, args->v[2].u8,
+                     ms, ANIM_EASE_INOUT) ) {
+        msh_puts_P(PSTR("Error: too many fades queued.\n"));
+        return 1;
+    }
+    return 0;
+}
+
+
+msh_define_help( blink, "blink the LED",
+        "Usage: blink 255 255 255 [ms [count]]\n"
+        "    On and off for ms each (default 500ms), count times or\n"
+        "    forever if count is 0 (default).\n");
+int cmd_blink(const msh_args* args)
+{
+    uint16_t ms    = ( args->count >= 4 ) ? args->v[3].u16 : 500;
+    uint8_t  count = ( args->count >= 5 ) ? args->v[4].u8 : 0;
+
+    anim_stop();
+    anim_push(args->v[0].u8, args->v[1].u8, args->v[2].u8, ms, ANIM_EASE_STEP);
+    anim_push(0, 0, 0, ms, ANIM_EASE_STEP);
+    anim_loop(count);
+    return 0;
+}
+
+
+msh_define_help( pattern, "play a predefined LED effect",
+        "Usage: pattern breathe|rainbow|alert|stop\n"
+        "    breathe: fade in and out of the current color\n"
+        "    rainbow: cycle through red, green and blue\n"
+        "    alert:   flash red 5 times\n"
+        "    stop:    stop any effect, keeping the current color\n");
+int cmd_pattern(const msh_args* args)
+{
+    /* the patterns are in the order of anim.ino, from 1 */
+    if ( args->v[0].u8 == 0 ) {
+        anim_stop();
+        return 0;
+    }
+    return anim_pattern_start(args->v[0].u8) ? 0 : 1;
+}
+
+
+msh_define_help( save, "save the LED state to restore at boot",
+        "Usage: save\n"
+        "    Saves the color, pattern and brightness to EEPROM.\n");
+int cmd_save(int argc, const char** argv)
+{
+    persist_save();
+    return 0;
+}
+
+
+msh_define_help( autosave, "show or set saving the LED state automatically",
+        "Usage: autosave [on|off]\n"
+        "    When on, the state is saved once it stays unchanged for\n"
+        "    2 seconds.\n");
+int cmd_autosave(const msh_args* args)
+{
+    if ( args->count == 1 ) {
+        persist_set_autosave(args->v[0].u8 == 1);
+    } else {
+        pico_puts( persist_get_autosave() ? "on\n" : "off\n" );
+    }
+    return 0;
+}
+
+
+msh_define_help( baud, "show or change the serial baud rate",
+        "Usage: baud [<rate> [save] | ok]\n"
+        "    Switches to <rate> after this reply. Switch the terminal too,\n"
+        "    and confirm with 'baud ok' within 2 seconds, or it goes back\n"
+        "    to the current rate. With 'save', the new rate is also used\n"
+        "    from the next boot. Rates: 9600, 19200, 38400, 57600, 115200,\n"
+        "    230400, 250000, 500000, 1000000\n");
+int cmd_baud(const msh_args* args)
+{
+    char buf[12];
+
+    if ( args->form == 0 ) {
+        pico_puts(ultoa(baud_get(), buf, 10));
+        pico_putchar('\n');
+        return 0;
+    }
+    if ( args->form == 1 ) {
+        if ( ! baud_confirm() ) {
+            msh_puts_P(PSTR("Error: no change to confirm.\n"));
             return 1;
         }
-        int r_pow = argv[1][0] - '0';
-        int g_pow = argv[1][1] - '0';
-        int b_pow = argv[1][2] - '0';
-
-        int r = (r_pow == 0) ? 0 : 1 << (r_pow - 1);
-        int g = (g_pow == 0) ? 0 : 1 << (g_pow - 1);
-        int b = (b_pow == 0) ? 0 : 1 << (b_pow - 1);
-        
-        led_rgb( (r < 255) ? r : 255,
-                 (g < 255) ? g : 255,
-                 (b < 255) ? b : 255 );
-    }
-    else if ( argc == 4 ) {
-        int r = atoi(argv[1]);
-        int g = atoi(argv[2]);
-        int b = atoi(argv[3]);
-        led_rgb(r, g, b);
+        return 0;
+    }
+    uint32_t rate = args->v[0].u32;
+    if ( ! baud_supported(rate) ) {
+        msh_puts_P(PSTR("Error: unsupported rate.\n"));
+        return 1;
+    }
+    if ( ! baud_propose(rate, args->count == 2) ) {
+        msh_puts_P(PSTR("Error: a change is in progress.\n"));
+        return 1;
+    }
+    return 0;
+}
+
+
+
+
+static void put_size(int indent, const char* label, unsigned long n)
+{
+    char buf[12];
+    int  width = 20 - indent - strlen_P(label) - strlen(ultoa(n, buf, 10));
+
+    while ( indent-- > 0 ) {
+        pico_putchar(' ');
+    }
+    msh_puts_P(label);
+    while ( width-- > 0 ) {
+        pico_putchar(' ');
+    }
+    pico_puts(buf);
+    pico_putchar('\n');
+}
+
+msh_define_help( mem, "show the SRAM usage",
+        "Usage: mem\n"
+        "    Shows the static data, heap used, the stack now and at its\n"
+        "    deepest since boot, RAM never used, and the static buffers\n"
+        "    of the shell, in bytes.\n");
+int cmd_mem(int argc, const char** argv)
+{
+    mem_info_t info;
+    const char* name;
+    unsigned int size;
+
+    if ( mem_get(&info) ) {
+        put_size(0, PSTR("ram"),        info.ram);
+        put_size(0, PSTR("static"),     info.static_ram);
+        put_size(0, PSTR("heap used"),  info.heap_used);
+        put_size(0, PSTR("stack now"),  info.stack_now);
+        put_size(0, PSTR("stack max"),  info.stack_max);
+        put_size(0, PSTR("never used"), info.never_used);
     } else {
-        pico_puts("Error: need exactly 1, or 3 arguments.");
+        msh_puts_P(PSTR("stack: not measured on this platform\n"));
+    }
+    for ( int i = 0;  (name = msh_get_buffer(i, &size)) != NULL;  i++ ) {
+        put_size(2, name, size);
     }
+    put_size(2, PSTR("argv (stack)"), sizeof(char*) * MSH_CMDARGS_MAX);
     return 0;
 }
 
 
+msh_define_help( px, "set pixels of the LED strip",
+        "Usage: px <pixels> <rrggbb> [<pixels> <rrggbb> ...]\n"
+        "    <pixels> is a comma separated list of N, A-B, * (all), or\n"
+        "    @<hex>, a bit mask with pixel 0 in the lowest bit.\n"
+        "    e.g. px 0-15 ff0000 @f0f 0000ff   Shown on 'show'.\n");
+int cmd_px(int argc, const char** argv)
+{
+    uint8_t rgb[3];
+
+    if ( argc < 3 || argc % 2 == 0 ) {
+        msh_puts_P(PSTR("Error: need pairs of pixels and a color.\n"));
+        return 1;
+    }
+    /* check all first, so that an error changes nothing */
+    for ( int i = 1;  i < argc;  i += 2 ) {
+        if ( ! strip_select(argv[i], NULL) ) {
+            msh_puts_P(PSTR("Error: bad pixels: "));
+            pico_puts(argv[i]);
+            pico_putchar('\n');
+            return 1;
+        }
+        if ( ! strip_parse_color(argv[i + 1], rgb) ) {
+            msh_puts_P(PSTR("Error: bad color: "));
+            pico_puts(argv[i + 1]);
+            pico_putchar('\n');
+            return 1;
+        }
+    }
+    for ( int i = 1;  i < argc;  i += 2 ) {
+        strip_parse_color(argv[i + 1], rgb);
+        strip_select(argv[i], rgb);
+    }
+    return 0;
+}
+
 
 /*
- * main() just loopingly read input line, parse, and execute.
+ * Parse a run "<count>x<rrggbb>" of rle.
  */
+static bool parse_run(const char* s, unsigned int* count, uint8_t rgb[3])
+{
+    char* end;
 
-int shell(void)
+    *count = strtoul(s, &end, 10);
+    return ( end != s && *end == 'x' && *count > 0 && *count <= STRIP_PIXELS
+             && strip_parse_color(end + 1, rgb) );
+}
+
+msh_define_help( rle, "fill runs of pixels of the LED strip",
+        "Usage: rle [<first>] <count>x<rrggbb> ...\n"
+        "    Sets <count> pixels from <first> (default 0) to each color\n"
+        "    in turn. e.g. rle 8xff0000 8x000000   Shown on 'show'.\n");
+int cmd_rle(int argc, const char** argv)
 {
-    char  linebuf[MSH_CMDLINE_CHAR_MAX];
+    unsigned int first = 0;
+    unsigned int count;
+    unsigned int end;
+    uint8_t rgb[3];
+    int i = 1;
 
-    io_open();
-    msh_set_prompt("LED> ");
+    if ( argc >= 2 && strchr(argv[1], 'x') == NULL ) {
+        char* e;
+        first = strtoul(argv[1], &e, 10);
+        if ( *e != '\0' || first >= STRIP_PIXELS ) {
+            msh_puts_P(PSTR("Error: bad first pixel.\n"));
+            return 1;
+        }
+        i = 2;
+    }
+    if ( i >= argc ) {
+        return 1;
+    }
+    end = first;
+    for ( int j = i;  j < argc;  j++ ) {
+        if ( ! parse_run(argv[j], &count, rgb) ) {
+            msh_puts_P(PSTR("Error: bad run: "));
+            pico_puts(argv[j]);
+            pico_putchar('\n');
+            return 1;
+        }
+        end += count;
+    }
+    if ( end > STRIP_PIXELS ) {
+        msh_puts_P(PSTR("Error: beyond the end of the strip.\n"));
+        return 1;
+    }
+    for ( ;  i < argc;  i++ ) {
+        parse_run(argv[i], &count, rgb);
+        while ( count-- > 0 ) {
+            strip_set(first++, rgb);
+        }
+    }
+    return 0;
+}
 
 
-    /*
-     * Loop for reading line (forever).
-     */
-    int   argc;
-    char* argv[MSH_CMDARGS_MAX];
-    char  argbuf[MSH_CMDLINE_CHAR_MAX];
-    while ( 1 ) {
-        /*
-         * Read a input line
-         */
-        if (  msh_get_cmdline(linebuf) == 0 ) {
-            /* got empty input */
-            continue;
+msh_define_help( show, "send the frame to the LED strip",
+        "Usage: show\n"
+        "    Sends all the pixels set by px and rle at once, and shows\n"
+        "    the time it took in us.\n");
+int cmd_show(int argc, const char** argv)
+{
+    put_size(0, PSTR("burst us"), strip_show());
+    return 0;
+}
+
+
+
+/*
+ * at and after: schedule the command in args->v[1]... to run at 'due'.
+ */
+static int schedule(unsigned long due, const msh_args* args)
+{
+    const char* argv[MSH_CMDARGS_MAX];
+    int argc = args->count - 1;
+
+    for ( int i = 0;  i < argc;  i++ ) {
+        argv[i] = args->v[i + 1].str;
+    }
+    int index = msh_command_index(argv[0]);
+    if ( index < 0 ) {
+        msh_puts_P(PSTR("Error: no such command: "));
+        pico_puts(argv[0]);
+        pico_putchar('\n');
+        return 1;
+    }
+    /* baud must reply before it switches, and output is muted here; the
+     * list of a def is only taken whole at the start of a line */
+    if ( strcmp(argv[0], "baud") == 0 || strcmp(argv[0], "def") == 0 ) {
+        msh_puts_P(PSTR("Error: can't schedule "));
+        pico_puts(argv[0]);
+        pico_putchar('\n');
+        return 1;
+    }
+    if ( ! sched_add(due, index, argc, argv) ) {
+        msh_puts_P(PSTR("Error: schedule full.\n"));
+        return 1;
+    }
+    return 0;
+}
+
+msh_define_help( at, "run a command at a time on the timeline",
+        "Usage: at <ms> <command> [args...]\n"
+        "    Runs the command <ms> after the time 0 set by 'sched zero'\n"
+        "    (or boot), with no output.\n");
+int cmd_at(const msh_args* args)
+{
+    return schedule(sched_at(args->v[0].u32), args);
+}
+
+
+msh_define_help( after, "run a command later",
+        "Usage: after <ms> <command> [args...]\n"
+        "    Runs the command <ms> from now, with no output.\n");
+int cmd_after(const msh_args* args)
+{
+    return schedule(millis() + args->v[0].u32, args);
+}
+
+
+msh_define_help( sched, "show or clear scheduled commands",
+        "Usage: sched [zero [<ms>] | clear]\n"
+        "    Shows the pending commands with ms until they run, the room\n"
+        "    left, and the worst lateness. zero: set the time 0 of 'at'\n"
+        "    to <ms> from now. clear: drop all and reset the counts.\n");
+int cmd_sched(const msh_args* args)
+{
+    char buf[12];
+
+    if ( args->form == 1 ) {
+        sched_set_zero(( args->count == 2 ) ? args->v[1].u32 : 0);
+        return 0;
+    }
+    if ( args->form == 2 ) {
+        sched_clear();
+        return 0;
+    }
+
+    const void* e = NULL;
+    long in_ms;
+    const char* words;
+    uint8_t n;
+    while ( (e = sched_list(e, &in_ms, &words, &n)) != NULL ) {
+        pico_puts(ltoa(in_ms, buf, 10));
+        while ( n-- > 0 ) {
+            pico_putchar(' ');
+            pico_puts(words);
+            words += strlen(words) + 1;
         }
+        pico_putchar('\n');
+    }
 
-        /*
-         * Loop for parse line and executing commands.
-         */
-        const char *linebufp = linebuf;
-        while ( 1 ) {
-            int i;
-            const char* ret_parse;
-            int ret_command;
+    sched_info_t info;
+    sched_get_info(&info);
+    put_size(0, PSTR("pending"),     info.pending);
+    put_size(0, PSTR("capacity"),    info.capacity);
+    put_size(0, PSTR("pool used"),   info.pool_used);
+    put_size(0, PSTR("pool size"),   info.pool_size);
+    put_size(0, PSTR("run"),         info.run);
+    put_size(0, PSTR("failed"),      info.failed);
+    put_size(0, PSTR("dropped"),     info.dropped);
+    put_size(0, PSTR("late max ms"), info.late_max_ms);
+    return 0;
+}
 
-            ret_parse = msh_parse_line(linebufp, argbuf, &argc, argv);
 
-            if ( ret_parse == NULL ) {
-                pico_puts("Syntax error\n");
-                break; /* discard this line */
-            }
-            if ( strlen(argv[0]) <= 0 ) {
-                break; /* empty input line */
+
+/* print a macro as it would be defined */
+static void put_macro(const char* name, const uint8_t* code, uint8_t len)
+{
+    const uint8_t* end = code + len;
+
+    pico_puts(name);
+    msh_puts_P(PSTR(" {"));
+    while ( code < end ) {
+        uint8_t index = *code++;
+        uint8_t argc  = *code++;
+
+        pico_putchar(' ');
+        msh_puts_P(msh_command_name(index));
+        if ( argc == 0 ) {
+            uint8_t packed = *code++;
+            msh_print_packed(index, code);
+            code += packed;
+        }
+        while ( argc > 0 && --argc > 0 ) {
+            const char* arg = (const char*)code;
+            bool quote = ( strpbrk(arg, " ;{}") != NULL || *arg == '\0' );
+            pico_putchar(' ');
+            if ( quote ) {
+                pico_putchar('\'');
             }
-            pico_puts("\n");
-
-            ret_command = msh_do_command(my_commands, argc, (const char**)argv);
-            if ( ret_command < 0 ) {
-                /* If the command not found amoung my_commands[], search the
-                 * buildin */
-                ret_command =
-                    msh_do_command(msh_builtin_commands, argc, (const char**)argv);
+            pico_puts(arg);
+            if ( quote ) {
+                pico_putchar('\'');
             }
-            if ( ret_command < 0 ) {
-                pico_puts("command not found: \'");
-                pico_puts(argv[0]);
-                pico_puts("'\n");
+            code += strlen(arg) + 1;
+        }
+        pico_putchar( ( code < end ) ? ';' : ' ' );
+    }
+    msh_puts_P(PSTR("}\n"));
+}
+
+msh_define_help( def, "define a macro, a list of commands",
+        "Usage: def [<name> [[+] { cmd; ... } | -] | save]\n"
+        "    Defines <name> to run the commands, or adds them to it\n"
+        "    with +, or deletes it with - (all with '*'). Run it by\n"
+        "    <name>. Without args, lists all. save: keep at boot.\n");
+int cmd_def(int argc, const char** argv)
+{
+    const char* name;
+    const uint8_t* code;
+    uint8_t len;
+    char buf[8];
+
+    if ( argc == 1 ) {
+        for ( uint8_t i = 0;  (name = macro_get(i, &code, &len)) != NULL;  i++ ) {
+            put_macro(name, code, len);
+        }
+        put_size(0, PSTR("pool used"), macro_pool_used());
+        return 0;
+    }
+    if ( argc == 2 && strcmp(argv[1], "save") == 0 ) {
+        macro_save();
+        return 0;
+    }
+    if ( argc == 2 ) {
+        for ( uint8_t i = 0;  (name = macro_get(i, &code, &len)) != NULL;  i++ ) {
+            if ( strcmp(name, argv[1]) == 0 ) {
+                put_macro(name, code, len);
+                return 0;
             }
+        }
+        msh_puts_P(PSTR("Error: no such macro.\n"));
+        return 1;
+    }
+    if ( argc == 3 && strcmp(argv[2], "-") == 0 ) {
+        if ( ! macro_delete(argv[1]) ) {
+            msh_puts_P(PSTR("Error: no such macro.\n"));
+            return 1;
+        }
+        return 0;
+    }
+
+    bool append = ( argc == 4 && strcmp(argv[2], "+") == 0 );
+    if ( argc != 3 && ! append ) {
+        const char* usage = msh_get_usage("def");
+        msh_puts_P(PSTR("Error: wrong number of arguments.\n"));
+        if ( usage != NULL ) {
+            msh_puts_P(usage);
+        }
+        return 1;
+    }
+    switch ( macro_define(argv[1], argv[argc - 1], append) ) {
+        case MACRO_OK:
+            return 0;
+        case MACRO_ERR_SYNTAX:
+            msh_puts_P(PSTR("Error: need { cmd; ... }\n"));
+            break;
+        case MACRO_ERR_COMMAND:
+            msh_puts_P(PSTR("Error: no such command, or def or baud, in the list.\n"));
+            break;
+        case MACRO_ERR_FULL:
+            msh_puts_P(PSTR("Error: no room; "));
+            pico_puts(utoa(macro_pool_used(), buf, 10));
+            msh_puts_P(PSTR(" bytes used.\n"));
+            break;
+        case MACRO_ERR_NAME:
+            msh_puts_P(PSTR("Error: bad name.\n"));
+            break;
+        case MACRO_ERR_ARGS:
+            break; /* told by msh_pack_args() */
+    }
+    return 1;
+}
+
+
+
+msh_define_help( stream, "take raw color frames at a fixed rate",
+        "Usage: stream [<fps>]\n"
+        "    Takes 3-byte frames r g b, and shows the latest one <fps>\n"
+        "    times a second; frames coming faster are dropped. The frame\n"
+        "    1b 1b 1b (or 10s of silence) returns to the shell. A LF\n"
+        "    right after the line (CR LF) is skipped. Without <fps>,\n"
+        "    shows the counts of the last stream.\n");
+int cmd_stream(const msh_args* args)
+{
+    stream_info_t info;
+
+    if ( args->count == 1 ) {
+        stream_start(args->v[0].u8);
+        return 0;
+    }
+    stream_get_info(&info);
+    put_size(0, PSTR("received"), info.received);
+    put_size(0, PSTR("applied"),  info.applied);
+    put_size(0, PSTR("dropped"),  info.dropped);
+    put_size(0, PSTR("resync"),   info.resync);
+    return 0;
+}
+
+
+
+
+/*
+ * In machine mode, there's no echo back nor prompt, and every command
+ * is answered by a line "#<seq> <rc>", after any output of the command.
+ * <seq> counts commands from 0, the 'mode machine' itself. An unknown
+ * command is answered with SHELL_RC_NOTFOUND, and a line which can't be
+ * parsed with SHELL_RC_SYNTAX.
+ */
+#define SHELL_RC_NOTFOUND  (-1)
+#define SHELL_RC_SYNTAX    (-2)
+
+static bool     machine_mode;
+static uint16_t reply_seq;
+
+msh_define_help( mode, "switch between human and machine interface",
+        "Usage: mode [human|machine]\n"
+        "    machine: no echo nor prompt. Each command is answered by\n"
+        "             '#<seq> <return code>' following its output.\n");
+int cmd_mode(const msh_args* args)
+{
+    if ( args->count == 1 ) {
+        machine_mode = ( args->v[0].u8 == 1 );
+        if ( machine_mode ) {
+            reply_seq = 0;
+        }
+    } else {
+        pico_puts( machine_mode ? "machine\n" : "human\n" );
+    }
+    msh_set_echo( ! machine_mode );
+    return 0;
+}
+
+static void shell_reply(int rc)
+{
+    char buf[8];
+
+    pico_putchar('#');
+    pico_puts(utoa(reply_seq++, buf, 10));
+    pico_putchar(' ');
+    pico_puts(itoa(rc, buf, 10));
+    pico_putchar('\n');
+}
+
+
+
+/*
+ * shell_setup() prepares the shell, and then loop() calls shell_poll()
+ * repeatedly. shell_poll() never blocks, so that loop() can do other
+ * things while waiting for an input line.
+ */
+
+void shell_setup(void)
+{
+    io_open();
+    msh_set_prompt("LED> ");
+    /* my_commands[] first, to override builtins of the same name */
+    if ( msh_register_commands(my_commands) < 0
+         || msh_register_commands(msh_builtin_commands) < 0 ) {
+        msh_puts_P(PSTR("Error: registry full; raise MSH_COMMANDS_MAX.\n"));
+    }
+}
+
+
+/*
+ * 'def <name> [+] { cmd; ... }': the list goes to def as one argument,
+ * braces and all, taken as it is up to the first '}' (they don't nest),
+ * so that the parser splits neither the commands nor their arguments.
+ * Returns false if 'line' is not such a def; or else sets *next as
+ * msh_parse_line_inplace() returns: past the ';' after the '}', 'line'
+ * if nothing follows, or NULL if malformed.
+ */
+static bool parse_def(char* line, int* argc, char** argv, char** next)
+{
+    char* p = line + strspn(line, " ");
+
+    if ( strncmp(p, "def ", 4) != 0 ) {
+        return false;
+    }
+    char* lbrace = p + strcspn(p, "{;");
+    if ( *lbrace != '{' || lbrace[-1] != ' ' ) {
+        return false;
+    }
+    *next = NULL;
+    char* rbrace = strchr(lbrace, '}');
+    if ( rbrace == NULL ) {
+        return true;
+    }
+    char* rest = rbrace + 1 + strspn(rbrace + 1, " ");
+    char  stop = *rest;
+    if ( stop != '\0' && stop != ';' ) {
+        return true;
+    }
+    lbrace[-1] = '\0';
+    rbrace[1]  = '\0';
+    if ( msh_parse_line_inplace(line, argc, argv) == NULL || *argc >= MSH_CMDARGS_MAX ) {
+        return true;
+    }
+    argv[(*argc)++] = lbrace;
+    *next = ( stop == ';' ) ? rest + 1 : line;
+    return true;
+}
+
+/*
+ * Parse and execute commands in a line. 'linebuf' is destroyed.
+ */
+static void shell_exec_line(char* linebuf)
+{
+    int   argc;
+    char* argv[MSH_CMDARGS_MAX];
+
+    /*
+     * Loop for parse line and executing commands.
+     * The line is tokenized in place, in the line editor's buffer.
+     */
+    char *linebufp = linebuf;
+    while ( 1 ) {
+        char* ret_parse;
+        int ret_command;
+        bool reply;
+
+        if ( ! parse_def(linebufp, &argc, argv, &ret_parse) ) {
+            ret_parse = msh_parse_line_inplace(linebufp, &argc, argv);
+        }
 
-            /*
-             * Do we have more sentents remained in linebuf
-             * separated by a ';' or a '\n' ?
-             */
-            if ( ret_parse == linebufp ) {
-                /* No, we don't */
-                break;
+        if ( ret_parse == NULL ) {
+            if ( machine_mode ) {
+                shell_reply(SHELL_RC_SYNTAX);
             } else {
-                /* Yes, we have. We have to parse rest of lines,
-                 * which begins with char* ret_parse; */
-                linebufp = ret_parse;
+                msh_puts_P(PSTR("Syntax error\n"));
             }
+            break; /* discard this line */
+        }
+        if ( argc == 0 ) {
+            break; /* empty input line */
+        }
+        if ( ! machine_mode ) {
+            msh_puts_P(PSTR("\n"));
+        }
+        /* 'mode human' is still answered as in machine mode */
+        reply = machine_mode;
+
+        ret_command = msh_exec_command(argc, (const char**)argv);
+        if ( ret_command < 0 && argc == 1 && msh_find_command(argv[0]) == NULL ) {
+            ret_command = macro_run(argv[0]);
+        }
+        if ( reply || machine_mode ) {
+            shell_reply(ret_command);
+        }
+        else
+        if ( ret_command < 0 ) {
+            msh_puts_P(PSTR("command not found: \'"));
+            pico_puts(argv[0]);
+            msh_puts_P(PSTR("'\n"));
+        }
+        pico_flush();
+
+        /*
+         * Do we have more sentents remained in linebuf
+         * separated by a ';' or a '\n' ?
+         */
+        if ( ret_parse == linebufp ) {
+            /* No, we don't */
+            break;
+        } else {
+            /* Yes, we have. We have to parse rest of lines,
+             * which begins with char* ret_parse; */
+            linebufp = ret_parse;
         }
     }
+}
 
-    io_close();
-    return 0;
+
+void shell_poll(void)
+{
+    /*
+     * Execute a line once it's complete. Empty input is just ignored.
+     */
+    if ( msh_poll() > 0 ) {
+        shell_exec_line( msh_get_line() );
+    }
+    pico_flush();
 }
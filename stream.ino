@@ -0,0 +1,131 @@
+/*
+ * Streaming raw color frames, for 'stream <fps>'.
+ *
+ * While streaming, every byte received is taken by stream_feed() before
+ * the frame decoder and the shell, as a part of 3-byte frames "r g b".
+ * A complete frame goes into the 'ready' slot of a pair of buffers, and
+ * the other one of them is filled next; stream_tick() shows the ready
+ * frame on a fixed tick of 1/fps second. A frame which comes while the
+ * previous one is still waiting for the tick replaces it, so the LED is
+ * always at most a tick behind the host, and the one replaced is counted
+ * as dropped.
+ *
+ * The frame STREAM_ESC STREAM_ESC STREAM_ESC ends the stream, so that color
+ * can't be shown; the host sends 1b1b1c instead. A frame is resynchronized
+ * by dropping a partial frame after a gap of STREAM_SYNC_MS, and the stream
+ * also ends after STREAM_IDLE_MS without any byte, not to lock the shell
+ * out if the host has gone. A '\n' as the first byte, within STREAM_SYNC_MS
+ * of the start, is the rest of a CR LF ending the 'stream' line, and is
+ * skipped; otherwise every frame after it would be a byte off.
+ */
+#include <stdint.h>
+#include "brink.h"
+
+#define STREAM_ESC       0x1B
+#define STREAM_SYNC_MS   20
+#define STREAM_IDLE_MS   10000
+
+static struct {
+    bool     active;
+    bool     ready;       /* buf[1 - fill] holds a frame for the tick */
+    bool     started;     /* a byte has come */
+    uint8_t  fill;        /* the buffer being received into */
+    uint8_t  pos;         /* bytes in buf[fill] */
+    uint8_t  buf[2][3];
+    unsigned long tick_us;     /* 1/fps */
+    unsigned long next_us;     /* the next tick */
+    unsigned long last_ms;     /* the last byte */
+    stream_info_t info;
+} stream;
+
+
+/*
+ * Start streaming at 'fps' (1 or more) frames per second.
+ */
+void stream_start(uint8_t fps)
+{
+    memset(&stream, 0, sizeof(stream));
+    stream.tick_us = 1000000UL / fps;
+    stream.next_us = micros() + stream.tick_us;
+    stream.last_ms = millis();
+    stream.active  = true;
+    anim_stop();
+}
+
+/*
+ * Take a received byte, if streaming. Returns false if not streaming, to
+ * pass the byte on.
+ */
+bool stream_feed(int c)
+{
+    unsigned long now = millis();
+
+    if ( ! stream.active ) {
+        return false;
+    }
+    if ( ! stream.started ) {
+        stream.started = true;
+        if ( c == '\n' && now - stream.last_ms <= STREAM_SYNC_MS ) {
+            stream.last_ms = now;
+            return true;
+        }
+    }
+    if ( stream.pos > 0 && now - stream.last_ms > STREAM_SYNC_MS ) {
+        stream.pos = 0;
+        stream.info.resync++;
+    }
+    stream.last_ms = now;
+
+    uint8_t* frame = stream.buf[stream.fill];
+    frame[stream.pos++] = c;
+    if ( stream.pos < 3 ) {
+        return true;
+    }
+    stream.pos = 0;
+    if ( frame[0] == STREAM_ESC && frame[1] == STREAM_ESC && frame[2] == STREAM_ESC ) {
+        stream.active = false;
+        return true;
+    }
+    stream.info.received++;
+    if ( stream.ready ) {
+        stream.info.dropped++; /* the newer one wins */
+    }
+    stream.fill ^= 1;
+    stream.ready = true;
+    return true;
+}
+
+/*
+ * Show the latest frame on the tick. Called from loop().
+ */
+void stream_tick(void)
+{
+    if ( ! stream.active ) {
+        return;
+    }
+    if ( millis() - stream.last_ms > STREAM_IDLE_MS ) {
+        stream.active = false;
+        return;
+    }
+    if ( (long)(micros() - stream.next_us) < 0 ) {
+        return;
+    }
+    stream.next_us += stream.tick_us;
+    if ( (long)(micros() - stream.next_us) >= 0 ) {
+        stream.next_us = micros() + stream.tick_us; /* fell behind; skip */
+    }
+    if ( stream.ready ) {
+        const uint8_t* frame = stream.buf[stream.fill ^ 1];
+        anim_set(frame[0], frame[1], frame[2]);
+        stream.ready = false;
+        stream.info.applied++;
+    }
+}
+
+/*
+ * The counts of the current or the last stream.
+ */
+void stream_get_info(stream_info_t* info)
+{
+    *info = stream.info;
+}
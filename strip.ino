@@ -0,0 +1,264 @@
+/*
+ * Addressable LED strip (WS2812 and alikes).
+ *
+ * Commands draw into a frame buffer of STRIP_PIXELS pixels, and nothing
+ * reaches the strip until strip_show() sends the whole frame in one go,
+ * so a frame built up by several commands appears at once.
+ *
+ * The frame is kept packed in the order the strip takes the bytes (GRB),
+ * and is sent by a driver, a pair of functions, so that other outputs
+ * can be plugged in with strip_set_driver(): the host build records the
+ * frames instead. The values go out as they are, with neither the gamma
+ * correction nor the brightness of the RGB LED.
+ */
+#include <stdint.h>
+#include "brink.h"
+
+#define STRIP_LATCH_US  300  /* low time to latch; WS2812B needs 280us */
+
+static uint8_t strip_frame[STRIP_PIXELS * 3];  /* G R B, G R B, ... */
+static unsigned long strip_shown_us;           /* when the last show ended */
+
+
+#if defined(__AVR__) && F_CPU == 16000000L
+/*
+ * WS2812 on STRIP_PORT bit STRIP_BIT, bit-banged at 800kHz: PD6, that is
+ * digital pin 6 of the Uno and Nano by default; other boards map pins
+ * differently, so define all three for them. Each bit starts high and
+ * goes low after 6 cycles (375ns) for a 0, or 12 cycles (750ns) for a 1,
+ * in a 21 cycle (1.3us) period at 16MHz. At other clocks there's no
+ * driver, and the frame goes nowhere.
+ */
+#ifndef STRIP_PORT
+#define STRIP_PORT  PORTD
+#define STRIP_DDR   DDRD
+#define STRIP_BIT   6
+#endif
+
+/* Send the 3 bytes of a pixel. Interrupts must be disabled. */
+static inline void ws2812_send(const uint8_t* p)
+{
+    uint8_t byte = *p++;
+    uint8_t bits = 8;
+    uint8_t left = 3;
+
+    asm volatile(
+        "1:                      \n\t"
+        "sbi  %[port], %[bit]    \n\t"  /* 2  high */
+        "nop                     \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "sbrs %[byte], 7         \n\t"  /* 1, or 2 skipping a 1 bit */
+        "cbi  %[port], %[bit]    \n\t"  /* 2  low at 6 for a 0 */
+        "lsl  %[byte]            \n\t"  /* 1 */
+        "dec  %[bits]            \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "cbi  %[port], %[bit]    \n\t"  /* 2  low at 12 for a 1 */
+        "nop                     \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "nop                     \n\t"  /* 1 */
+        "brne 1b                 \n\t"  /* 2  next bit */
+        "ld   %[byte], %a[ptr]+  \n\t"  /* reads one past the pixel at last */
+        "ldi  %[bits], 8         \n\t"
+        "dec  %[left]            \n\t"
+        "brne 1b                 \n\t"
+        : [byte] "+r" (byte), [bits] "+d" (bits), [left] "+r" (left), [ptr] "+e" (p)
+        : [port] "I" (_SFR_IO_ADDR(STRIP_PORT)), [bit] "I" (STRIP_BIT));
+}
+
+static void ws2812_begin(void)
+{
+    STRIP_PORT &= ~_BV(STRIP_BIT);
+    STRIP_DDR  |= _BV(STRIP_BIT);
+}
+
+/*
+ * The whole frame goes out with interrupts off (about 32us a pixel, 1.9ms
+ * for 60), so that nothing stretches the low time between two pixels: a
+ * WS2812B is only guaranteed to latch after 280us low, but some parts do
+ * after 5us or so. Between pixels here the line is low for about 1us.
+ *
+ * Meanwhile Serial can't take input, and the USART holds only 2 bytes:
+ * enough for 60 pixels at 9600 baud. For a longer frame, or a faster
+ * rate, the host is stopped by XOFF first (pico_rx_pause()).
+ */
+#define WS2812_PIXEL_US  32
+
+static void ws2812_show(const uint8_t* grb, uint8_t n)
+{
+    if ( (unsigned long)n * WS2812_PIXEL_US > 20000000UL / baud_get() ) {
+        pico_rx_pause();
+    }
+    uint8_t sreg = SREG;
+    cli();
+    while ( n-- > 0 ) {
+        ws2812_send(grb);
+        grb += 3;
+    }
+    SREG = sreg;
+}
+
+static const strip_driver_t ws2812_driver = { ws2812_begin, ws2812_show };
+static const strip_driver_t* strip_driver = &ws2812_driver;
+#else
+static const strip_driver_t* strip_driver = NULL;  /* see strip_set_driver() */
+#endif /* __AVR__ && 16MHz */
+
+
+/*
+ * Use 'driver' instead of the default one; call before strip_setup().
+ */
+void strip_set_driver(const strip_driver_t* driver)
+{
+    strip_driver = driver;
+}
+
+void strip_setup(void)
+{
+    if ( strip_driver && strip_driver->begin ) {
+        strip_driver->begin();
+    }
+    strip_show(); /* all off */
+}
+
+void strip_set(uint8_t i, const uint8_t rgb[3])
+{
+    uint8_t* p = &strip_frame[i * 3];
+    p[0] = rgb[1];
+    p[1] = rgb[0];
+    p[2] = rgb[2];
+}
+
+/*
+ * Send the frame to the strip. Returns the time it took in us, including
+ * waiting for the previous frame to latch.
+ */
+unsigned long strip_show(void)
+{
+    unsigned long start = micros();
+
+    while ( micros() - strip_shown_us < STRIP_LATCH_US ) {
+        ; /* let the strip latch the previous frame */
+    }
+    if ( strip_driver ) {
+        strip_driver->show(strip_frame, STRIP_PIXELS);
+    }
+    strip_shown_us = micros();
+    return strip_shown_us - start;
+}
+
+
+static int8_t strip_hexdigit(char c)
+{
+    if ( c >= '0' && c <= '9' ) return c - '0';
+    if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Parse exactly 6 hex digits "rrggbb" into rgb[].
+ */
+bool strip_parse_color(const char* s, uint8_t rgb[3])
+{
+    for ( uint8_t i = 0;  i < 3;  i++ ) {
+        int8_t hi = strip_hexdigit(*s++);
+        int8_t lo = ( hi < 0 ) ? -1 : strip_hexdigit(*s++);
+        if ( lo < 0 ) {
+            return false;
+        }
+        rgb[i] = hi << 4 | lo;
+    }
+    return ( *s == '\0' );
+}
+
+/* Parse a pixel number ending at one of 'ends'. Returns NULL if invalid. */
+static const char* strip_parse_index(const char* s, uint8_t* i, const char* ends)
+{
+    char* end;
+    unsigned long n = strtoul(s, &end, 10);
+
+    if ( end == s || n >= STRIP_PIXELS || strchr(ends, *end) == NULL ) {
+        return NULL;
+    }
+    *i = n;
+    return end;
+}
+
+/* '@hex': bit i, from the last digit, selects pixel i */
+static const char* strip_select_mask(const char* s, const uint8_t* rgb)
+{
+    const char* last = s;
+    uint8_t i = 0;
+
+    while ( strip_hexdigit(*last) >= 0 ) {
+        last++;
+    }
+    if ( last == s ) {
+        return NULL;
+    }
+    for ( const char* p = last - 1;  p >= s;  p--, i += 4 ) {
+        int8_t bits = strip_hexdigit(*p);
+        for ( uint8_t b = 0;  b < 4;  b++ ) {
+            if ( ! ( bits & 1 << b ) ) {
+                continue;
+            }
+            if ( i + b >= STRIP_PIXELS ) {
+                return NULL;
+            }
+            if ( rgb ) {
+                strip_set(i + b, rgb);
+            }
+        }
+    }
+    return last;
+}
+
+/*
+ * Set the pixels selected by 'sel' to 'rgb', or only check 'sel' if
+ * 'rgb' is NULL. 'sel' is a comma separated list of:
+ *     N     a pixel, from 0
+ *     A-B   pixels A to B, inclusive
+ *     *     all the pixels
+ *     @hex  a bit mask; the lowest bit is pixel 0, e.g. @f0f
+ * Returns false if 'sel' is malformed or out of the strip, possibly after
+ * setting some of the pixels; so check it first.
+ */
+bool strip_select(const char* sel, const uint8_t* rgb)
+{
+    const char* s = sel;
+
+    while ( 1 ) {
+        uint8_t first = 0;
+        uint8_t last  = STRIP_PIXELS - 1;
+        bool    mask  = ( *s == '@' );
+
+        if ( *s == '*' ) {
+            s++;
+        }
+        else
+        if ( mask ) {
+            s = strip_select_mask(s + 1, rgb);
+        }
+        else
+        if ( (s = strip_parse_index(s, &first, ",-")) != NULL ) {
+            last = first;
+            if ( *s == '-' ) {
+                s = strip_parse_index(s + 1, &last, ",");
+            }
+        }
+        if ( s == NULL || first > last || ( *s != ',' && *s != '\0' ) ) {
+            return false;
+        }
+        if ( rgb && ! mask ) {
+            for ( uint8_t i = first;  i <= last;  i++ ) {
+                strip_set(i, rgb);
+            }
+        }
+        if ( *s++ == '\0' ) {
+            return true;
+        }
+    }
+}